@@ -0,0 +1,167 @@
+#include "atlas.h"
+
+//  Glyph atlas renderer (SHRETERM_RENDERER=atlas)
+//
+// Each glyph is rasterized once with FreeType and uploaded into a single
+// server-side GlyphSet, the atlas, with its advance set to its cell width.
+// drawRun does not draw; it queues the run's glyph ids per colour, and
+// flushText sends everything queued in one colour as one
+// XRenderCompositeText32 request. A full-screen repaint is then a few
+// requests, however many rows it has. Queued text is only drawn at a flush,
+// so code that paints over text with the GC must flush first.
+
+struct atlasQueue
+{
+    int originX = 0, originY = 0; // first run's position (request origin)
+    int penX = 0, penY = 0;       // where the last run left the pen
+    vector<unsigned> ids;
+    vector<pair<size_t, XGlyphElt32>> elts; // (first index into ids, element)
+};
+
+struct glyphAtlas
+{
+    GlyphSet set = 0;
+    Picture dst = 0;                // the terminal window
+    XRenderPictFormat *a8 = nullptr;
+    unsigned nextId = 1;
+    unordered_map<uint64_t, unsigned> ids;        // glyph cache key -> atlas id
+    unordered_map<unsigned long, Picture> fills;  // solid source per 0xRRGGBB
+    map<unsigned long, atlasQueue> queued;        // per colour, until flushText
+};
+
+bool initAtlas(textFont *f, Drawable d)
+{
+    if (f->atlas)
+        return true;
+    int evBase, errBase;
+    if (!XRenderQueryExtension(f->dpy, &evBase, &errBase))
+        return false;
+    XRenderPictFormat *winFormat = XRenderFindVisualFormat(f->dpy, DefaultVisual(f->dpy, f->screen));
+    XRenderPictFormat *a8 = XRenderFindStandardFormat(f->dpy, PictStandardA8);
+    if (!winFormat || !a8)
+        return false;
+    glyphAtlas *A = new glyphAtlas;
+    A->a8 = a8;
+    A->set = XRenderCreateGlyphSet(f->dpy, a8);
+    A->dst = XRenderCreatePicture(f->dpy, d, winFormat, 0, nullptr);
+    f->atlas = A;
+    return true;
+}
+
+void selectRenderer(textFont *f, Drawable d, const char *name)
+{
+    f->useAtlas = name && strcmp(name, "atlas") == 0 && initAtlas(f, d);
+}
+
+// Atlas id of cp, rasterizing and uploading it on first use.
+static unsigned atlasGlyph(textFont *f, uint32_t cp, int cells)
+{
+    glyphAtlas &A = *f->atlas;
+    uint64_t key = ((uint64_t)cp << 8) | TEXT_REGULAR;
+    auto it = A.ids.find(key);
+    if (it != A.ids.end())
+        return it->second;
+
+    glyphRef g = lookupGlyph(f, cp, TEXT_REGULAR);
+    XGlyphInfo info{};
+    vector<char> img;
+    FT_Face face = XftLockFace(g.font);
+    if (face && FT_Load_Glyph(face, g.index, FT_LOAD_RENDER | FT_LOAD_TARGET_LIGHT) == 0 &&
+        (face->glyph->bitmap.pixel_mode == FT_PIXEL_MODE_GRAY || face->glyph->bitmap.pixel_mode == FT_PIXEL_MODE_MONO))
+    {
+        const FT_Bitmap &bm = face->glyph->bitmap;
+        int stride = ((int)bm.width + 3) & ~3; // A8 rows are padded to 32 bits
+        img.assign((size_t)stride * bm.rows, 0);
+        for (unsigned r = 0; r < bm.rows; ++r)
+            for (unsigned c = 0; c < bm.width; ++c)
+            {
+                const unsigned char *row = bm.buffer + (long)r * bm.pitch;
+                bool mono = bm.pixel_mode == FT_PIXEL_MODE_MONO;
+                img[(size_t)r * stride + c] = mono ? ((row[c >> 3] & (0x80 >> (c & 7))) ? 0xFF : 0) : row[c];
+            }
+        info.width = (unsigned short)bm.width;
+        info.height = (unsigned short)bm.rows;
+        info.x = (short)-face->glyph->bitmap_left;
+        info.y = (short)face->glyph->bitmap_top;
+    }
+    if (face)
+        XftUnlockFace(g.font);
+
+    // glyphs advance by whole cells; combining marks sit over the previous cell
+    info.xOff = (short)(cells * f->cellW);
+    if (cells == 0)
+        info.x += f->cellW;
+
+    Glyph id = A.nextId++;
+    XRenderAddGlyphs(f->dpy, A.set, &id, &info, 1, img.data(), (int)img.size());
+    A.ids.emplace(key, (unsigned)id);
+    return (unsigned)id;
+}
+
+static int atlasDrawRun(textFont *f, int x, int y, const char *s, size_t n, unsigned long rgb)
+{
+    atlasQueue &q = f->atlas->queued[rgb];
+    if (q.elts.empty())
+    {
+        q.originX = q.penX = x;
+        q.originY = q.penY = y;
+    }
+    size_t first = q.ids.size();
+    int cx = x;
+    for (size_t i = 0; i < n;)
+    {
+        size_t used;
+        uint32_t cp = decodeUtf8(s + i, n - i, used);
+        i += used;
+        if (cp < 0x20 || cp == 0x7F)
+            cp = ' '; // keeps the pen in step with the cell grid
+        int cells = charCells(cp);
+        q.ids.push_back(atlasGlyph(f, cp, cells));
+        cx += cells * f->cellW;
+    }
+    if (q.ids.size() > first)
+    {
+        XGlyphElt32 e{};
+        e.glyphset = f->atlas->set;
+        e.nchars = (int)(q.ids.size() - first);
+        e.xOff = x - q.penX;
+        e.yOff = y - q.penY;
+        q.elts.push_back({first, e});
+        q.penX = cx;
+        q.penY = y;
+    }
+    return cx - x;
+}
+
+void flushText(textFont *f)
+{
+    if (!f->useAtlas)
+        return;
+    glyphAtlas &A = *f->atlas;
+    vector<XGlyphElt32> elts;
+    for (auto &[rgb, q] : A.queued)
+    {
+        if (q.elts.empty())
+            continue;
+        auto fill = A.fills.find(rgb);
+        if (fill == A.fills.end())
+        {
+            XRenderColor rc = textColor(f, rgb)->color;
+            fill = A.fills.emplace(rgb, XRenderCreateSolidFill(f->dpy, &rc)).first;
+        }
+        elts.clear();
+        for (auto &[firstId, e] : q.elts)
+        {
+            e.chars = q.ids.data() + firstId;
+            elts.push_back(e);
+        }
+        XRenderCompositeText32(f->dpy, PictOpOver, fill->second, A.dst, A.a8, 0, 0,
+                               q.originX, q.originY, elts.data(), (int)elts.size());
+    }
+    A.queued.clear();
+}
+
+int drawRun(textFont *f, int x, int y, const char *s, size_t n, unsigned long rgb)
+{
+    return f->useAtlas ? atlasDrawRun(f, x, y, s, n, rgb) : xftDrawRun(f, x, y, s, n, rgb);
+}
@@ -0,0 +1,14 @@
+#pragma once
+#include "text.h"
+
+//  Glyph atlas renderer (atlas.cpp)
+
+// Set up the atlas for f's window. False if the server has no RENDER.
+bool initAtlas(textFont *f, Drawable d);
+// "atlas" selects the atlas renderer, anything else (or no RENDER) Xft.
+void selectRenderer(textFont *f, Drawable d, const char *name);
+// Draw everything queued by the atlas renderer (no-op for Xft).
+void flushText(textFont *f);
+// Draw (or queue, for the atlas) n bytes of UTF-8 with the baseline at y;
+// returns the advance.
+int drawRun(textFont *f, int x, int y, const char *s, size_t n, unsigned long rgb);
@@ -0,0 +1,955 @@
+#include "core.h"
+#include "exec.h"
+#include "find.h"
+#include "history.h"
+#include "jobs.h"
+#include "record.h"
+#include "sessionlog.h"
+#include "termstat.h"
+#include "trace.h"
+#include "helper_funcs.h"
+
+//  Terminal core
+//
+// Key handling, pastes and the per-iteration servicing of tabs, written
+// against a renderer (render.cpp) so the same code drives the X window
+// (run.cpp) and the headless build (headless.cpp). Keys arrive already
+// looked up: the platform side turns its events into keyInput.
+
+void followHistory(size_t before, uint64_t reloads)
+{
+    for (auto &t : tabs)
+        if (reloads != histReloads || t.inpIdx >= (int)before)
+            t.inpIdx = (int)inputs.size();
+}
+
+static void recordHistory(const string &cmd, const string &cwd, int status, long long ms)
+{
+    size_t before = inputs.size();
+    uint64_t reloads = histReloads;
+    storeHistory(cmd, cwd, status, ms);
+    followHistory(before, reloads);
+}
+
+void awaitHistory()
+{
+    if (awaitHistoryLoad())
+        for (auto &t : tabs)
+            t.inpIdx = (int)inputs.size();
+}
+
+pasteState paste;
+
+void finishPaste(tabState *T)
+{
+    recordEvent('W', {T ? T->id : -1});
+    paste.active = false;
+    paste.incr = false;
+    if (T)
+    {
+        T->statusLine.clear();
+        T->multLineFlag = T->input.count('"') % 2 == 1;
+    }
+}
+
+void insertPasteChunk(tabState &T, string chunk)
+{
+    if (recording())
+        recordEvent('V', {T.id}, {chunk});
+    chunk.erase(remove(chunk.begin(), chunk.end(), '\r'), chunk.end());
+    if (paste.heldNewline && !chunk.empty())
+    {
+        chunk.insert(chunk.begin(), '\n');
+        paste.heldNewline = false;
+    }
+    if (!chunk.empty() && chunk.back() == '\n')
+    {
+        chunk.pop_back();
+        paste.heldNewline = true;
+    }
+    size_t cur = min((size_t)max(0, T.currentCursorPosition), T.input.size());
+    T.input.insert(cur, chunk.data(), chunk.size());
+    T.currentCursorPosition = (int)(cur + chunk.size());
+    paste.bytes += chunk.size();
+}
+
+// A command started from the prompt is still running; the tab waits for it.
+static bool commandStarted(const tabState &T)
+{
+    return T.fg.pgid && !T.fg.resumed;
+}
+
+// Run a command for a tab. While recording its output goes to the session
+// file; while replaying the recorded output is used instead and nothing runs.
+// Without wait a pipeline may be left running (commandStarted); it is
+// recorded when it ends (endForeground).
+static vector<string> sessionExec(const string &cmd, tabState &T, bool wait = true)
+{
+    if (replaying)
+    {
+        const sessionRecord *r = replayTakeOutput(T.id);
+        if (!r || r->nums.empty() || r->strs.size() < 2)
+        {
+            replayDiverged++;
+            return {"ERROR: replay: no recorded output for " + cmd};
+        }
+        if (r->strs[0] != cmd)
+            replayDiverged++;
+        T.lastStatus = (int)r->nums[0];
+        T.cwd = r->strs[1];
+        return vector<string>(r->strs.begin() + 2, r->strs.end());
+    }
+    vector<string> outputs = execInDir(cmd, T, wait);
+    if (recording() && !commandStarted(T))
+    {
+        vector<string> fields{cmd, T.cwd};
+        fields.insert(fields.end(), outputs.begin(), outputs.end());
+        recordEvent('O', {T.lastStatus, T.id}, fields);
+    }
+    return outputs;
+}
+
+// The tab's foreground command has ended (lines: its output) or was stopped
+// (lines: the Stopped note). The prompt comes back; a command started from
+// it goes into history and the recording now (its worker has written the
+// session log record).
+static void endForeground(tabState &T, vector<string> lines, int status)
+{
+    tabState::foregroundCmd fg = std::move(T.fg);
+    T.fg = {};
+    T.lastStatus = status;
+    if (!fg.resumed)
+    {
+        long long ms = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - fg.start).count();
+        if (fg.recordHist)
+            recordHistory(fg.cmd, fg.cwd, status, ms);
+        if (recording())
+        {
+            vector<string> fields{fg.cmd, T.cwd};
+            fields.insert(fields.end(), lines.begin(), lines.end());
+            recordEvent('O', {status, T.id}, fields);
+        }
+    }
+    for (auto &line : lines)
+    {
+        if (fg.resumed && recording())
+            recordEvent('M', {T.id}, {line});
+        T.displayBuffer.push_back(std::move(line));
+    }
+    if (!T.userScrolled)
+        T.scrlOffset = INT_MAX; // makeScreen clamps this to the bottom
+}
+
+bool handleKey(renderer &R, const keyInput &k)
+{
+    TRACE_SCOPE("handleKey");
+    if (!(tabActive >= 0 && tabActive < (int)tabs.size()))
+        return true;
+
+    tabState &T = tabs[tabActive];
+    KeySym keysym = k.keysym;
+    const string &typed = k.typed;
+
+    // only the keys that use history wait for it to load
+    if (keysym == XK_Up || keysym == XK_Down || keysym == XK_Return || keysym == XK_KP_Enter ||
+        k.first == L'\r' || k.first == L'\n' || ((k.state & ControlMask) && (keysym == XK_r || keysym == XK_R)))
+        awaitHistory();
+
+    // metrics
+    int lineHeight = R.lineH();
+    int seeRows = max(1, (winGeom.height - (NAVBAR_H + 30)) / lineHeight);
+
+    // Ctrl+Shift+G: filter scrollback to lines matching a regex. Enter keeps
+    // the filter and goes back to the prompt, Escape removes it.
+    if ((k.state & ControlMask) && (k.state & ShiftMask) && (keysym == XK_g || keysym == XK_G))
+    {
+        T.filterEditing = !T.filterEditing;
+        makeScreen(R, T);
+        return true;
+    }
+    if (T.filterEditing)
+    {
+        if (keysym == XK_Escape)
+        {
+            T.filterEditing = false;
+            T.filter.clear();
+        }
+        else if (keysym == XK_Return || keysym == XK_KP_Enter)
+            T.filterEditing = false;
+        else if (keysym == XK_BackSpace || !typed.empty())
+        {
+            string p = T.filter.pattern;
+            if (keysym == XK_BackSpace)
+            {
+                if (p.empty())
+                    return true;
+                p.erase(utf8Prev(p, p.size()));
+            }
+            else
+                p += typed;
+            T.filter.set(p);
+        }
+        else
+            return true;
+        int totalDisplayLines = makeScreen(R, T);
+        T.scrlOffset = max(0, totalDisplayLines - seeRows);
+        T.userScrolled = false;
+        makeScreen(R, T);
+        return true;
+    }
+
+    // Ctrl+Shift+F: find in scrollback; while it is open keys edit the query
+    if ((k.state & ControlMask) && (k.state & ShiftMask) && (keysym == XK_f || keysym == XK_F))
+    {
+        if (T.findFlag)
+            endFind(T);
+        else
+            T.findFlag = true;
+        makeScreen(R, T);
+        return true;
+    }
+    if (T.findFlag)
+    {
+        if (keysym == XK_Escape)
+        {
+            endFind(T);
+            makeScreen(R, T);
+        }
+        // Enter/Up: older match, Shift+Enter/Down: newer
+        else if (keysym == XK_Return || keysym == XK_KP_Enter)
+            stepFind(R, T, (k.state & ShiftMask) ? 1 : -1);
+        else if (keysym == XK_Up)
+            stepFind(R, T, -1);
+        else if (keysym == XK_Down)
+            stepFind(R, T, 1);
+        else if (keysym == XK_BackSpace || !typed.empty())
+        {
+            if (keysym == XK_BackSpace)
+            {
+                if (T.findQuery.empty())
+                    return true;
+                T.findQuery.erase(utf8Prev(T.findQuery, T.findQuery.size()));
+            }
+            else
+                T.findQuery += typed;
+            startFind(T);
+            showFindHit(R, T);
+        }
+        return true;
+    }
+
+    // Escape: exit app
+    if (keysym == XK_Escape)
+    {
+        // soft-exit: close current tab if >1, else exit
+        if (tabs.size() > 1)
+        {
+            hangupTabJobs(T.id);
+            stopWatch(T.id);
+            dropPendingFrame(T.id);
+            sessionLogCloseTab(T.id);
+            tabs.erase(tabActive);
+            howerXClose = -1;
+            if (tabActive >= (int)tabs.size())
+                tabActive = (int)tabs.size() - 1;
+            makeNavBar(R, winGeom.width);
+            makeTabs(R);
+            if (!tabs.empty())
+                makeScreen(R, tabs[tabActive]);
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // PageUp/Down, Home/End
+    if (keysym == XK_Page_Up)
+    {
+        T.scrlOffset = max(0, T.scrlOffset - SCROLL_STEP * 5);
+        T.userScrolled = true;
+        makeScreen(R, T);
+        return true;
+    }
+    else if (keysym == XK_Page_Down)
+    {
+        int totalDisplayLines = makeScreen(R, T);
+        T.scrlOffset = min(max(0, totalDisplayLines - seeRows), T.scrlOffset + SCROLL_STEP * 5);
+        if (T.scrlOffset >= max(0, totalDisplayLines - seeRows))
+            T.userScrolled = false;
+        makeScreen(R, T);
+        return true;
+    }
+    else if (keysym == XK_Home && (k.state & ControlMask))
+    {
+        T.scrlOffset = 0;
+        T.userScrolled = true;
+        makeScreen(R, T);
+        return true;
+    }
+    else if (keysym == XK_End && (k.state & ControlMask))
+    {
+        int totalDisplayLines = makeScreen(R, T);
+        T.scrlOffset = max(0, totalDisplayLines - seeRows);
+        T.userScrolled = false;
+        makeScreen(R, T);
+        return true;
+    }
+
+    // A running foreground command has the tab: the prompt is not shown, so
+    // only Ctrl+C, Ctrl+Z and switching tabs get through
+    if (T.fg.pgid && !((k.state & ControlMask) && (keysym == XK_c || keysym == XK_C || keysym == XK_z ||
+                                                   keysym == XK_Z || keysym == XK_Tab || keysym == XK_ISO_Left_Tab)))
+        return true;
+
+    // History up/down
+    if (keysym == XK_Up)
+    {
+        if (T.searchFlag || T.recommFlag)
+        { /* ignore */
+        }
+        else if (!inputs.empty())
+        {
+            T.multLineFlag = false;
+            if (T.inpIdx > 0)
+                T.inpIdx--;
+            else
+                T.inpIdx = 0;
+
+            T.input = inputs[T.inpIdx];
+            T.multLineFlag = T.input.count('"') % 2 == 1;
+            T.currentCursorPosition = (int)T.input.size();
+            makeScreen(R, T);
+        }
+        return true;
+    }
+    if (keysym == XK_Down)
+    {
+        if (T.searchFlag || T.recommFlag)
+        { /* ignore */
+        }
+        else if (!inputs.empty())
+        {
+            T.multLineFlag = false;
+            if (T.inpIdx < (int)inputs.size() - 1)
+            {
+                T.inpIdx++;
+                T.input = inputs[T.inpIdx];
+            }
+            else
+            {
+                T.inpIdx = (int)inputs.size();
+                T.input.clear();
+            }
+            T.multLineFlag = T.input.count('"') % 2 == 1;
+            T.currentCursorPosition = (int)T.input.size();
+            makeScreen(R, T);
+        }
+        return true;
+    }
+
+    // Left/Right
+    if (keysym == XK_Left)
+    {
+        T.currentCursorPosition = (int)utf8Prev(T.input, T.currentCursorPosition);
+        makeScreen(R, T);
+        return true;
+    }
+    if (keysym == XK_Right)
+    {
+        T.currentCursorPosition = (int)utf8Next(T.input, T.currentCursorPosition);
+        makeScreen(R, T);
+        return true;
+    }
+
+    // Ctrl+V paste request
+    if ((k.state & ControlMask) && (keysym == XK_v || keysym == XK_V))
+    {
+        // a new paste replaces any transfer still in progress
+        if (paste.active)
+        {
+            finishPaste(tabById(paste.tabId));
+        }
+        paste = pasteState();
+        paste.active = true;
+        paste.tabId = T.id;
+        paste.lastPaint = chrono::steady_clock::now();
+        R.requestPaste();
+        return true;
+    }
+
+    // Ctrl+R search
+    if ((k.state & ControlMask) && (keysym == XK_r || keysym == XK_R))
+    {
+        // the line being edited stays in scrollback, as before the overlay
+        echoInput(T);
+        T.input.clear();
+        T.currentCursorPosition = 0;
+        T.searchFlag = true;
+        makeScreen(R, T);
+        return true;
+    }
+
+    // Ctrl+A start
+    if ((k.state & ControlMask) && (keysym == XK_a || keysym == XK_A))
+    {
+        if (T.searchFlag)
+            T.currentCursorPosition = 0;
+        else
+            T.currentCursorPosition = T.count;
+        makeScreen(R, T);
+        return true;
+    }
+    // Ctrl+E end
+    if ((k.state & ControlMask) && (keysym == XK_e|| keysym == XK_E))
+    {
+        T.currentCursorPosition = (int)T.input.size();
+        makeScreen(R, T);
+        return true;
+    }
+    if ((k.state & ControlMask) && keysym == XK_Tab)
+    {
+        if (!tabs.empty())
+        {
+            tabActive = (tabActive + 1) % tabs.size();
+            makeNavBar(R, winGeom.width);
+            makeTabs(R);
+            makeScreen(R, tabs[tabActive]);
+        }
+        return true;
+    }
+
+    // Ctrl + Shift + Tab → previous tab
+    if ((k.state & ControlMask) && (k.state & ShiftMask) && keysym == XK_ISO_Left_Tab)
+    {
+        if (!tabs.empty())
+        {
+            tabActive = (tabActive - 1 + tabs.size()) % tabs.size();
+            makeNavBar(R, winGeom.width);
+            makeTabs(R);
+            makeScreen(R, tabs[tabActive]);
+        }
+        return true;
+    }
+    // Tab completion (your logic)
+    if (keysym == XK_Tab)
+    {
+        if (!T.input.empty())
+        {
+            T.recommFlag = true;
+            T.forRec = T.input.str();
+            T.query = extractQuery(T.forRec);
+            if (T.query == T.forRec && T.query.rfind("./", 0) == 0)
+                T.query = T.query.substr(2);
+
+            // list directory allCandidates under tab cwd
+            auto outputs = sessionExec("ls", T);
+            vector<string> allCandidates;
+            for (auto &l : outputs)
+                if (!l.empty() && l.rfind("ERROR:", 0) != 0)
+                    allCandidates.push_back(l);
+
+            T.recs = getRecommendations(T.query, allCandidates);
+            if (T.recs.empty())
+            {
+                T.recommFlag = false;
+            }
+            else if (T.recs.size() == 1)
+            {
+                T.input += T.recs[0].substr(T.query.size());
+                T.recommFlag = false;
+                T.currentCursorPosition = (int)T.input.size();
+            }
+            else
+            {
+                // options and the choice are part of the overlay
+                T.showRec.clear();
+                for (size_t i = 0; i < T.recs.size(); i++)
+                    T.showRec += to_string(i + 1) + ". " + T.recs[i] + "  ";
+                T.input.clear();
+                T.currentCursorPosition = 0;
+            }
+            makeScreen(R, T);
+        }
+        return true;
+    }
+    // Ctrl + C handling for multiWatch stop
+    if ((k.state & ControlMask) && (keysym == XK_c || keysym == XK_C))
+    {
+        // Interrupt only this tab's foreground job / multiWatch
+            bool wasWatching = T.watching;
+            bool wasRunning = T.fg.pgid != 0;
+            getSigint(T.id);
+
+            // Give this tab's watcher a short time to finish and restore the
+            // screen; no wait if the tab has none running.
+            awaitWatchEnd(T.id, chrono::milliseconds(500));
+
+            // Append ^C to screenBuffer (after the abandoned line) and redraw
+            tabState &T2 = tabs[tabActive];
+            applyPendingFrame(T2); // the restored pre-watch screen
+            T2.watching = false;
+            if (wasWatching || wasRunning)
+                T2.displayBuffer.push_back("^C");
+            else
+            {
+                echoInput(T2, "^C");
+                T2.input.clear();
+                T2.currentCursorPosition = 0;
+            }
+
+            makeScreen(R, T2);
+
+        return true;
+    }
+
+    // Ctrl+Z stops the tab's foreground command; serviceTabs gives the
+    // prompt back once the stop is seen, and fg resumes it
+    if ((k.state & ControlMask) && (keysym == XK_z || keysym == XK_Z))
+    {
+        if (T.fg.pgid && signalForeground(T.id, SIGTSTP))
+        {
+            T.displayBuffer.push_back("^Z");
+            makeScreen(R, T);
+        }
+        return true;
+    }
+
+    // Printable input
+    if (k.chars)
+    {
+        // ENTER
+        if (k.first == L'\r' || k.first == L'\n')
+        {
+            if (T.recommFlag)
+            {
+                int recIdx = min(getRecIdx(T.input.str()), (int)T.recs.size()) - 1;
+                if (recIdx < 0)
+                    recIdx = 0;
+                string rec = T.recs[recIdx];
+                T.input = T.forRec + rec.substr(T.query.size());
+                T.currentCursorPosition = (int)T.input.size();
+                T.recommFlag = false;
+                T.showRec.clear();
+                makeScreen(R, T);
+                return true;
+            }
+
+            if (T.searchFlag)
+            {
+                string term = T.input.str();
+                string search_res = searchFromHistory(term);
+                T.displayBuffer.push_back("REC:Enter search term:" + term);
+                T.input.clear();
+                if (search_res != "No match for search term in history")
+                {
+                    T.input = search_res;
+                    T.multLineFlag = T.input.count('"') % 2 == 1;
+                    T.currentCursorPosition = (int)T.input.size();
+                }
+                else
+                {
+                    T.displayBuffer.push_back(search_res);
+                    T.currentCursorPosition = 0;
+                }
+                T.searchFlag = false;
+                makeScreen(R, T);
+                return true;
+            }
+
+            if (T.multLineFlag)
+            {
+                T.input.insert(T.currentCursorPosition, '\n');
+                T.currentCursorPosition++;
+                T.count = (int)T.input.size();
+                    makeScreen(R, T);
+                return true;
+            }
+            else
+            {
+                // the submitted line moves from the overlay into scrollback
+                string cmd = T.input.str();
+                echoInput(T);
+
+                // recorded once we know how the command went
+                bool recordHist = !cmd.empty() && (inputs.empty() || inputs.back() != cmd);
+                T.count = 0;
+                T.inpIdx = (int)inputs.size() + (recordHist ? 1 : 0);
+
+                auto trimLocal = [](const string &s) -> string
+                {
+                    size_t a = 0, b = s.size();
+                    while (a < b && isspace((unsigned char)s[a]))
+                        ++a;
+                    while (b > a && isspace((unsigned char)s[b - 1]))
+                        --b;
+                    return s.substr(a, b - a);
+                };
+                string stripped = trimLocal(cmd);
+
+                if (stripped == "history" || stripped == "history --compact")
+                {
+                    if (recordHist)
+                        recordHistory(cmd, T.cwd, 0, 0);
+                    vector<string> lines = (stripped == "history") ? historyLines() : compactHistory();
+                    T.inpIdx = (int)inputs.size();
+                    for (auto &line : lines)
+                        T.displayBuffer.push_back(std::move(line));
+                    T.input.clear();
+                    T.currentCursorPosition = 0;
+                    int totalDisplayLines = makeScreen(R, T);
+                    if (!T.userScrolled)
+                    {
+                        T.scrlOffset = max(0, totalDisplayLines - seeRows);
+                        makeScreen(R, T);
+                    }
+                    return true;
+                }
+                if (stripped == "renderbench" || stripped.rfind("renderbench ", 0) == 0)
+                {
+                    if (recordHist)
+                        recordHistory(cmd, T.cwd, 0, 0);
+                    vector<string> lines = renderBench(R, T, trimLocal(stripped.substr(11)));
+                    for (auto &line : lines)
+                        T.displayBuffer.push_back(std::move(line));
+                    T.input.clear();
+                    T.currentCursorPosition = 0;
+                    int totalDisplayLines = makeScreen(R, T);
+                    if (!T.userScrolled)
+                    {
+                        T.scrlOffset = max(0, totalDisplayLines - seeRows);
+                        makeScreen(R, T);
+                    }
+                    return true;
+                }
+                if (stripped == "termstat" || stripped.rfind("termstat ", 0) == 0)
+                {
+                    vector<string> lines = termstatBuiltin(trimLocal(stripped.substr(8)), T.cwd);
+                    for (auto &line : lines)
+                        T.displayBuffer.push_back(std::move(line));
+                    T.input.clear();
+                    T.currentCursorPosition = 0;
+                    int totalDisplayLines = makeScreen(R, T);
+                    if (!T.userScrolled)
+                    {
+                        T.scrlOffset = max(0, totalDisplayLines - seeRows);
+                        makeScreen(R, T);
+                    }
+                    return true;
+                }
+                if (stripped == "clear")
+                {
+                    if (recordHist)
+                        recordHistory(cmd, T.cwd, 0, 0);
+                    resetDisplay(T);
+                    T.input.clear();
+                    T.currentCursorPosition = 0;
+                    T.multLineFlag = false;
+                    int totalDisplayLines = makeScreen(R, T);
+                    T.scrlOffset = max(0, totalDisplayLines - seeRows);
+                    T.userScrolled = false;
+                    makeScreen(R, T);
+                    return true;
+                }
+                if (stripped.rfind("multiWatch", 0) == 0)
+                    {
+                        if (recordHist)
+                            recordHistory(cmd, T.cwd, 0, 0);
+                        size_t start = cmd.find('[');
+                        size_t end = cmd.find(']');
+                        if (start != string::npos && end != string::npos && end > start)
+                        {
+                            string inside = cmd.substr(start + 1, end - start - 1);
+                            vector<string> cmds;
+                            regex r("\"([^\"]+)\"");
+                            smatch m;
+                            string::const_iterator s(inside.cbegin());
+                            while (regex_search(s, inside.cend(), m, r))
+                            {
+                                cmds.push_back(m[1]);
+                                s = m.suffix().first;
+                            }
+
+                            if (cmds.empty())
+                            {
+                                T.displayBuffer.push_back("multiWatch: No valid commands found.");
+                            }
+                            else
+                            {
+                                // Copy old screen buffer safely
+                                vector<string> oldBuffer;
+                                oldBuffer.insert(oldBuffer.end(), T.displayBuffer.begin(), T.displayBuffer.end());
+
+                                // Clear screen for watch mode
+                                resetDisplay(T, {"multiWatch — starting..."});
+                                T.watching = true;
+
+                                // Pass oldBuffer to thread so it can restore later
+                                // (a replay brings the recorded frames instead)
+                                if (!replaying)
+                                    thread([cmds, tab_id = T.id, oldBuffer, w = startWatch(T.id)]()
+                                           { multiWatchThreaded_using_pipes(cmds, tab_id, oldBuffer, w); })
+                                        .detach();
+                            }
+                        }
+                        else
+                        {
+                            T.displayBuffer.push_back("Usage: multiWatch [\"cmd1\", \"cmd2\", ...]");
+                        }
+
+                        // Clear input for next command
+                        T.input.clear();
+                        T.currentCursorPosition = 0;
+                        return true;
+                    }
+                // execute in tab cwd
+                string cmdCwd = T.cwd;
+                time_t startedAt = time(nullptr);
+                auto cmdStart = chrono::steady_clock::now();
+                vector<string> outputs = sessionExec(cmd, T, false);
+                T.input.clear();
+                T.currentCursorPosition = 0;
+                if (commandStarted(T))
+                {
+                    // it ends in serviceTabs, which adds its output
+                    T.fg.cmd = cmd;
+                    T.fg.cwd = cmdCwd;
+                    T.fg.start = cmdStart;
+                    T.fg.recordHist = recordHist;
+                    makeScreen(R, T);
+                    return true;
+                }
+                long long cmdMs = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - cmdStart).count();
+                if (recordHist)
+                    recordHistory(cmd, cmdCwd, T.lastStatus, cmdMs);
+                if (sessionLogEnabled(T.id))
+                    sessionLogCommand(T.id, startedAt, cmdCwd, cmd, T.lastStatus, cmdMs, outputs);
+
+                // Push command output lines (moved, they can be large)
+                for (auto &line : outputs)
+                    T.displayBuffer.push_back(std::move(line));
+
+                int totalDisplayLines = makeScreen(R, T);
+                if (!T.userScrolled)
+                {
+                    T.scrlOffset = max(0, totalDisplayLines - seeRows);
+                    makeScreen(R, T);
+                }
+                return true;
+            }
+        }
+
+        // BACKSPACE
+        if (k.first == 8 || k.first == 127)
+        {
+            // one whole character, not one byte
+            size_t prev = utf8Prev(T.input, T.currentCursorPosition);
+            if ((T.searchFlag || T.recommFlag) && !T.input.empty())
+            {
+                if (T.currentCursorPosition > 0)
+                {
+                    T.input.erase(prev, T.currentCursorPosition - prev);
+                    T.currentCursorPosition = (int)prev;
+                }
+                makeScreen(R, T);
+                return true;
+            }
+
+            if (T.currentCursorPosition > 0)
+            {
+                if (T.input[prev] == '"')
+                    T.multLineFlag = !T.multLineFlag;
+                T.input.erase(prev, T.currentCursorPosition - prev);
+                T.currentCursorPosition = (int)prev;
+                    makeScreen(R, T);
+            }
+            return true;
+        }
+
+        // Regular printable text (UTF-8)
+        string text = (k.first == L'\t') ? string("\t") : typed;
+        if (!text.empty())
+        {
+            if (!T.recommFlag && !T.searchFlag && count(text.begin(), text.end(), '"') % 2 == 1)
+                T.multLineFlag = !T.multLineFlag;
+            T.input.insert(T.currentCursorPosition, text.data(), text.size());
+            T.currentCursorPosition += (int)text.size();
+            makeScreen(R, T);
+            return true;
+        }
+    }
+    return true;
+}
+
+void redrawAll(renderer &R)
+{
+    makeNavBar(R, winGeom.width);
+    makeTabs(R);
+    if (tabActive >= 0 && tabActive < (int)tabs.size())
+        makeScreen(R, tabs[tabActive]);
+}
+
+void handleResize(renderer &R, int width, int height)
+{
+    winGeom.width = width;
+    winGeom.height = height;
+    redrawAll(R);
+}
+
+void handleButton(renderer &R, int x, int y, unsigned button)
+{
+    // navbar test first
+    int tabIdx = -1;
+    int hit = navbarHit(x, y, navbarLayout(), &tabIdx);
+
+    if (hit == -2) // "+" clicked
+    {
+        addTab("/");
+        redrawAll(R);
+        return;
+    }
+    else if (hit == -3 && tabIdx >= 0) // "×" close clicked
+    {
+        if (tabIdx < (int)tabs.size())
+        {
+            hangupTabJobs(tabs[tabIdx].id);
+            stopWatch(tabs[tabIdx].id);
+            sessionLogCloseTab(tabs[tabIdx].id);
+            dropPendingFrame(tabs[tabIdx].id);
+            tabs.erase(tabIdx);
+            howerXClose = -1;
+            if (tabActive >= (int)tabs.size())
+                tabActive = (int)tabs.size() - 1;
+            redrawAll(R);
+        }
+        return;
+    }
+    else if (hit >= 0) // clicked on tab
+    {
+        if (hit < (int)tabs.size())
+            tabActive = hit;
+        redrawAll(R);
+        return;
+    }
+
+    // content area events (scroll)
+    if (tabActive >= 0 && tabActive < (int)tabs.size())
+    {
+        tabState &T = tabs[tabActive];
+
+        int lineHeight = R.lineH();
+        int seeRows = max(1, (winGeom.height - (NAVBAR_H + 30)) / lineHeight);
+
+        if (button == Button4)
+        { // wheel up
+            T.scrlOffset = max(0, T.scrlOffset - SCROLL_STEP);
+            T.userScrolled = true;
+            makeScreen(R, T);
+        }
+        else if (button == Button5)
+        { // wheel down
+            int totalDisplayLines = makeScreen(R, T);
+            T.scrlOffset = min(max(0, totalDisplayLines - seeRows),
+                                 T.scrlOffset + SCROLL_STEP);
+            if (T.scrlOffset >= max(0, totalDisplayLines - seeRows))
+                T.userScrolled = false;
+            makeScreen(R, T);
+        }
+    }
+}
+
+void serviceTabs(renderer &R, bool visible)
+{
+    TRACE_SCOPE("serviceTabs");
+    // jobs that stopped or finished; a finished job is only reported once
+    // its output has been queued, so its note goes after the lines below
+    vector<jobNote> notes;
+    if (reapPending || jobStateChangeExpected())
+    {
+        reapPending = false;
+        notes = reapJobs();
+    }
+
+    // take the queued lines and let the workers go on while they are added
+    queue<watchMsg> msgs;
+    vector<commandResult> results;
+    {
+        lock_guard<mutex> lk(mwQueueMutex);
+        msgs.swap(mwQueue);
+        results.swap(commandResults);
+    }
+    bool activeChanged = false;
+    auto append = [&](int tabId, string &text)
+    {
+        tabState *T = tabById(tabId);
+        if (!T)
+            return;
+        if (recording())
+            recordEvent('M', {tabId}, {text});
+        T->displayBuffer.push_back(std::move(text));
+        // follow the output unless the user scrolled away; other tabs only
+        // accumulate and are laid out when activated
+        if (!T->userScrolled)
+            T->scrlOffset = INT_MAX; // makeScreen clamps this to the bottom
+        if (T == activeTab())
+            activeChanged = true;
+    };
+    for (; !msgs.empty(); msgs.pop())
+        append(msgs.front().tabId, msgs.front().text);
+    for (auto &n : notes)
+    {
+        tabState *T = tabById(n.tabId);
+        if (T && T->fg.pgid == n.pgid)
+        {
+            // the job the tab waits for: stopped, or a resumed one has ended
+            endForeground(*T, n.done ? vector<string>{} : vector<string>{std::move(n.line)},
+                          n.done ? shellStatus(n.status) : 128 + SIGTSTP);
+            if (T == activeTab())
+                activeChanged = true;
+        }
+        else
+            append(n.tabId, n.line);
+    }
+    for (auto &res : results)
+    {
+        tabState *T = tabById(res.tabId);
+        if (T && T->fg.pgid == res.pgid)
+        {
+            endForeground(*T, std::move(res.lines), res.status);
+            if (T == activeTab())
+                activeChanged = true;
+            continue;
+        }
+        // moved to the background in the meantime
+        for (auto &line : res.lines)
+            append(res.tabId, line);
+        if (!res.note.empty())
+            append(res.tabId, res.note);
+    }
+    if (activeChanged && visible)
+        makeScreen(R, tabs[tabActive]);
+
+    // new multiWatch frame for the tab on screen (makeScreen applies it)
+    if (visible && tabActive >= 0 && tabActive < (int)tabs.size() && framePending(tabs[tabActive].id))
+        makeScreen(R, tabs[tabActive]);
+
+    // find in scrollback: search output that arrived, show a finished scan
+    if (tabActive >= 0 && tabActive < (int)tabs.size() && tabs[tabActive].findFlag)
+    {
+        tabState &T = tabs[tabActive];
+        bool finished = findScanFinished && !T.findScanning;
+        if (finished)
+            findScanFinished = false;
+        size_t hitsBefore = T.findHits.size();
+        bool scanned = findCatchUp(T);
+        if (finished && T.findCurrent < 0 && !T.findHits.empty())
+        {
+            T.findCurrent = (int)T.findHits.size() - 1;
+            if (visible)
+                showFindHit(R, T);
+        }
+        else if ((finished || (scanned && T.findHits.size() != hitsBefore)) && visible)
+            makeScreen(R, T);
+    }
+}
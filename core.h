@@ -0,0 +1,62 @@
+#pragma once
+#include "draw.h"
+
+//  Terminal core (core.cpp)
+
+// History grew (our append, or another instance's) or was rebuilt after a
+// compaction: tabs that were past the newest entry stay there; a rebuild
+// restarts browsing in every tab.
+void followHistory(size_t before, uint64_t reloads);
+
+// History is loaded in the background at startup; whatever uses it waits
+// for the load here. Tabs opened meanwhile start browsing from its end.
+void awaitHistory();
+
+// Clipboard paste in progress (Ctrl+V). Small selections arrive in one
+// SelectionNotify; large ones use the INCR protocol and arrive as a series
+// of PropertyNotify chunks, each inserted into the input as it comes.
+struct pasteState
+{
+    bool active = false;
+    bool incr = false;
+    bool triedString = false; // fell back from UTF8_STRING to STRING
+    int tabId = -1;
+    size_t bytes = 0;
+    bool heldNewline = false; // last chunk ended in '\n'; kept only if more follows
+    chrono::steady_clock::time_point lastPaint;
+};
+
+extern pasteState paste;
+
+void finishPaste(tabState *T);
+
+// Insert one chunk of pasted text at the cursor in a single bulk edit.
+// A trailing newline is held back so the paste does not end in an empty line.
+void insertPasteChunk(tabState &T, string chunk);
+
+// A key press after input-method lookup.
+struct keyInput
+{
+    KeySym keysym = 0;
+    unsigned state = 0;   // modifier mask (ControlMask, ShiftMask, ...)
+    bool chars = false;   // the lookup produced characters
+    wchar_t first = 0;    // first of them (Enter, Backspace and Tab come as characters)
+    string typed;         // printable characters as UTF-8
+};
+
+// Handle one key press in the active tab. Returns false when the last tab
+// was closed and the terminal should exit.
+bool handleKey(renderer &R, const keyInput &k);
+
+// Navbar, tabs and the active tab, e.g. after an Expose.
+void redrawAll(renderer &R);
+
+void handleResize(renderer &R, int width, int height);
+
+// A button press: navbar clicks, and the wheel scrolling the active tab.
+void handleButton(renderer &R, int x, int y, unsigned button);
+
+// Work that does not wait for input: output from workers, finished jobs,
+// multiWatch frames and find catch-up. The active tab is repainted only if
+// visible.
+void serviceTabs(renderer &R, bool visible);
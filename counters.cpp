@@ -0,0 +1,28 @@
+#include "counters.h"
+
+//  Performance counters
+//
+// Cumulative since startup and shown by the termstat builtin (termstat.cpp),
+// as text or as JSON for monitoring. Counters that worker threads bump are
+// atomic. The per-command timings are maps guarded by statMutex, and the rest
+// is only touched by the event loop.
+
+perfCounters counters;
+
+const chrono::steady_clock::time_point processStart = chrono::steady_clock::now();
+
+mutex statMutex;
+map<string, timingStat> execTimes;
+map<string, timingStat> watchTimes;
+timingStat watchCycles;
+
+uint64_t usSince(chrono::steady_clock::time_point t0)
+{
+    return (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - t0).count();
+}
+
+void addTiming(map<string, timingStat> &m, const string &key, uint64_t us)
+{
+    lock_guard<mutex> lk(statMutex);
+    m[key].add(us);
+}
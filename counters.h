@@ -0,0 +1,43 @@
+#pragma once
+#include "headers.h"
+
+//  Performance counters (counters.cpp)
+
+struct timingStat
+{
+    uint64_t count = 0;
+    uint64_t totalUs = 0;
+    uint64_t maxUs = 0;
+
+    void add(uint64_t us)
+    {
+        count++;
+        totalUs += us;
+        maxUs = max(maxUs, us);
+    }
+};
+
+struct perfCounters
+{
+    atomic<uint64_t> forks{0};
+    atomic<uint64_t> captureBytes{0}; // read from command output pipes
+    uint64_t screenCalls = 0;         // makeScreen
+    uint64_t screenUs = 0;
+    uint64_t wrappedLines = 0;        // scrollback lines run through line wrapping
+    uint64_t xRequests = 0;           // sent to the X server, as of the last flush
+    uint64_t historyLoadUs = 0;
+    uint64_t startupUs = 0;           // process start to the first frame flushed
+    uint64_t restoreUs = 0;           // restoring the saved tabs (snapshot.cpp)
+};
+extern perfCounters counters;
+
+// set during static initialisation, just before main()
+extern const chrono::steady_clock::time_point processStart;
+
+extern mutex statMutex;
+extern map<string, timingStat> execTimes;  // foreground commands, by program name
+extern map<string, timingStat> watchTimes; // multiWatch, by command
+extern timingStat watchCycles;             // multiWatch, whole refreshes
+
+uint64_t usSince(chrono::steady_clock::time_point t0);
+void addTiming(map<string, timingStat> &m, const string &key, uint64_t us);
@@ -1,77 +1,154 @@
-#include "headers.cpp"
-#include "helper_funcs.cpp"
+#include "draw.h"
+#include "helper_funcs.h"
+#include "counters.h"
+#include "history.h"
+#include "record.h"
+#include "termstat.h"
+#include "trace.h"
+
+Display *disp;
+int scr;
+Window root;
+
+winGeometry winGeom;
+
+Atom atomClipboard = None;
+Atom atomUtf8String = None;
+Atom atomPasteBuffer = None;
+Atom atomIncr = None;
+
+void internAtoms()
+{
+    const char *names[] = {"CLIPBOARD", "UTF8_STRING", "PASTE_BUFFER", "INCR"};
+    Atom atoms[4];
+    if (!XInternAtoms(disp, (char **)names, 4, False, atoms))
+        return;
+    atomClipboard = atoms[0];
+    atomUtf8String = atoms[1];
+    atomPasteBuffer = atoms[2];
+    atomIncr = atoms[3];
+}
+
+// Round-trip audit (SHRETERM_X11_AUDIT=1, in builds made with make
+// X11_AUDIT=1): every Xlib call that waits for a reply goes through _XReply,
+// so counting calls here catches all of them, including ones made inside
+// Xlib on our behalf. Wrapping Xlib's internal symbol is only acceptable as
+// a diagnostic, so normal builds leave _XReply alone.
+#ifdef X11_AUDIT
+static unsigned long x11Replies = 0;
 
-static Display *disp;
-static int scr;
-static Window root;
+extern "C" Status _XReply(Display *dpy, void *rep, int extra, Bool discard)
+{
+    using replyFn = Status (*)(Display *, void *, int, Bool);
+    static replyFn real = (replyFn)dlsym(RTLD_NEXT, "_XReply");
+    ++x11Replies;
+    return real(dpy, rep, extra, discard);
+}
 
-static const int ROWS = 24; // kept (not directly used, but retained)
-#define POSX 200
-#define POSY 200
-#define WIDTH 900
-#define HEIGHT 600
-#define BORDER 8
+unsigned long x11RoundTrips() { return x11Replies; }
+#else
+unsigned long x11RoundTrips() { return 0; }
+#endif
 
-// navbar constants
-static const int NAVBAR_H = 40;
-static const int TAB_PADDING = 8;
-static const int TAB_SPACING = 4;
+bool x11AuditEnabled()
+{
+    static int on = -1;
+    if (on < 0)
+    {
+        const char *v = getenv("SHRETERM_X11_AUDIT");
+        on = (v && *v && strcmp(v, "0") != 0) ? 1 : 0;
+#ifndef X11_AUDIT
+        if (on)
+            cerr << "x11 audit: not built in, rebuild with make X11_AUDIT=1\n";
+        on = 0;
+#endif
+    }
+    return on == 1;
+}
+
+// Shell prompt for a tab's cwd.
+static string promptFor(const tabState &T)
+{
+    string sdisp = editPWD(T.cwd);
+    return (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
+}
 
-//  Per-tab state
+void resetDisplay(tabState &T, vector<string> lines)
+{
+    T.displayBuffer = std::move(lines);
+    T.bufGen++;
+}
 
-struct tabState
+void echoInput(tabState &T, const string &suffix)
 {
-    // UI buffers / state
-    vector<string> displayBuffer;
-    vector<string> oldBuffer;
-    string input;
-    int currentCursorPosition = 0;
-    bool searchFlag = false;
-    bool recommFlag = false;
-    string showRec = "";
-    vector<string> recs;
-    string query = "";
-    string forRec = "";
-    int inpIdx = 0;
-    int scrlOffset = 0;
-    bool userScrolled = false;
-    bool multLineFlag = false;
-    int count = 0;
-    // cursor blink
-    bool dispCursor = true;
-    chrono::steady_clock::time_point lastBlink = chrono::steady_clock::now();
-    // per-tab cwd
-    string cwd = "/";
-    // title
-    string title;
-};
+    string prompt = promptFor(T);
+    for (size_t l = 0; l < T.input.lineCount(); ++l)
+        T.displayBuffer.push_back((l == 0 ? prompt : string()) + T.input.line(l));
+    T.displayBuffer.back() += suffix;
+}
 
 // tab chrome
 
-static int tabActive = -1;
-static vector<tabState> tabs;
+int tabActive = -1;
+tabList tabs;
+static int nextTabId = 1;
+
+tabState *tabById(int id)
+{
+    auto it = tabs.ids.find(id);
+    return it == tabs.ids.end() ? nullptr : it->second;
+}
+
+tabState *activeTab()
+{
+    return tabActive >= 0 && tabActive < (int)tabs.size() ? &tabs[tabActive] : nullptr;
+}
+
+// Latest multiWatch frame per tab id that has not been shown yet. Watcher
+// threads only replace the frame here; the UI thread moves it into the tab's
+// displayBuffer when that tab is drawn, so a tab that is not on screen only
+// ever holds its newest frame and costs no layout or drawing.
+static mutex frameMutex;
+static map<int, vector<string>> pendingFrames; // guarded by frameMutex
 
-struct tabPosNavbar
+void postFrame(int tabId, vector<string> frame)
 {
-    int x;
-    int w;
-    int xClose;
-    int wClose;
-    bool isPlus;
-};
+    lock_guard<mutex> lk(frameMutex);
+    pendingFrames[tabId] = std::move(frame);
+}
 
-static const int SCROLL_STEP = 3; // lines per wheel/page step
+bool framePending(int tabId)
+{
+    lock_guard<mutex> lk(frameMutex);
+    return pendingFrames.count(tabId) > 0;
+}
 
-// Globals shared across tabs
-vector<string> inputs; // history (shared)
+void applyPendingFrame(tabState &T)
+{
+    lock_guard<mutex> lk(frameMutex);
+    auto it = pendingFrames.find(T.id);
+    if (it == pendingFrames.end())
+        return;
+    recordEvent('F', {T.id}, it->second);
+    resetDisplay(T, std::move(it->second));
+    pendingFrames.erase(it);
+}
 
-static Window makeWindow(int x, int y, int h, int w, int b)
+void dropPendingFrame(int tabId)
+{
+    lock_guard<mutex> lk(frameMutex);
+    pendingFrames.erase(tabId);
+}
+
+Window makeWindow(int x, int y, int h, int w, int b)
 {
     Window win;
     XSetWindowAttributes xwa;
     xwa.background_pixel = BlackPixel(disp, scr);
     xwa.border_pixel = WhitePixel(disp, scr); // white border
-    xwa.event_mask = ExposureMask | KeyPressMask | ButtonPressMask | StructureNotifyMask;
+    xwa.event_mask = ExposureMask | KeyPressMask | ButtonPressMask | StructureNotifyMask |
+                     FocusChangeMask | VisibilityChangeMask | PointerMotionMask | LeaveWindowMask |
+                     PropertyChangeMask;
     win = XCreateWindow(
         disp, root, x, y, w, h, b,
         DefaultDepth(disp, scr),
@@ -79,105 +156,245 @@ static Window makeWindow(int x, int y, int h, int w, int b)
         DefaultVisual(disp, scr),
         CWBackPixel | CWBorderPixel | CWEventMask,
         &xwa);
+    winGeom.width = w;
+    winGeom.height = h;
     return win;
 }
 
-static int makeScreen(Window win, GC gc, XFontStruct *font,
-                      tabState &T)
+static const string promptPrefix = "shre@Term:";
+
+// Split a line of n UTF-8 bytes into rows no wider than maxW pixels, as
+// (start, len) byte pairs. A row never splits a character; a wide character
+// that does not fit moves to the next row. Plain ASCII (ascii = true) is
+// split arithmetically without looking at the bytes.
+template <typename CharAt>
+static void wrapRowsOf(size_t n, CharAt charAt, int cellW, int maxW,
+                       vector<pair<size_t, size_t>> &rows, bool ascii = false)
+{
+    if (n == 0)
+    {
+        rows.push_back({0, 0});
+        return;
+    }
+    size_t perRow = (size_t)max(1, maxW / cellW);
+    if (ascii)
+    {
+        for (size_t s = 0; s < n; s += perRow)
+            rows.push_back({s, min(perRow, n - s)});
+        return;
+    }
+
+    size_t start = 0, cells = 0, pos = 0;
+    char ch[4];
+    while (pos < n)
+    {
+        size_t used = 1;
+        size_t w = 1;
+        if ((unsigned char)charAt(pos) >= 0x80)
+        {
+            size_t k = 0;
+            for (; k < 4 && pos + k < n; ++k)
+                ch[k] = charAt(pos + k);
+            w = (size_t)charCells(decodeUtf8(ch, k, used));
+        }
+        if (cells + w > perRow && pos > start)
+        {
+            rows.push_back({start, pos - start});
+            start = pos;
+            cells = 0;
+        }
+        cells += w;
+        pos += used;
+    }
+    rows.push_back({start, n - start});
+}
+
+// Bring T.wrapRows up to date: wrap lines appended since the last call, or
+// everything if the width changed or the buffer was replaced. With a filter
+// on, only the lines in its view are wrapped.
+static void updateWrapCache(tabState &T, int cellW, int maxW)
 {
+    TRACE_SCOPE("updateWrapCache");
+    T.filter.update(T.displayBuffer, T.bufGen);
+    bool filtered = T.filter.active();
+    size_t shown = filtered ? T.filter.view.size() : T.displayBuffer.size();
+    if (T.wrapWidth != maxW || T.wrapGen != T.bufGen || T.wrapViewGen != T.filter.viewGen || T.wrappedLines > shown)
+    {
+        T.wrapRows.clear();
+        T.wrappedLines = 0;
+        T.wrapWidth = maxW;
+        T.wrapGen = T.bufGen;
+        T.wrapViewGen = T.filter.viewGen;
+    }
+
+    vector<pair<size_t, size_t>> pieces;
+    for (size_t v = T.wrappedLines; v < shown; ++v)
+    {
+        size_t i = filtered ? T.filter.view[v] : v;
+        const string &line = T.displayBuffer[i];
+        pieces.clear();
+        wrapRowsOf(line.size(), [&](size_t k) { return line[k]; }, cellW, maxW, pieces);
+        bool isPrompt = line.rfind(promptPrefix, 0) == 0;
+        for (auto &[start, len] : pieces)
+            T.wrapRows.push_back({i, start, len, (start == 0 && isPrompt) ? (int)min(len, promptPrefix.size()) : 0});
+    }
+    counters.wrappedLines += shown - T.wrappedLines;
+    T.wrappedLines = shown;
+}
+
+int makeScreen(renderer &R, tabState &T)
+{
+    TRACE_SCOPE("makeScreen");
+    auto started = chrono::steady_clock::now();
+
+    // catch up on watcher output that arrived while the tab was not drawn
+    applyPendingFrame(T);
+
     // window metrics
-    XWindowAttributes atrbs;
-    XGetWindowAttributes(disp, win, &atrbs);
-    int winWidth = atrbs.width;
-    int winHeight = atrbs.height;
+    int winWidth = winGeom.width;
+    int winHeight = winGeom.height;
 
     // Clear only content area (below navbar)
-    XClearArea(disp, win, 0, NAVBAR_H, winWidth, winHeight - NAVBAR_H, False);
+    R.clear(0, NAVBAR_H, winWidth, winHeight - NAVBAR_H);
 
-    int lineH = font->ascent + font->descent;
+    int lineH = R.lineH();
 
     // margins inside content
     int marginLeft = 10;
     int marginTop = NAVBAR_H + 30;
+    int maxW = winWidth - marginLeft - 10;
 
-    // allocate colors once
-    static bool colorsInit = false;
-    static unsigned long greenPixel = WhitePixel(disp, scr);
-    static unsigned long whitePixel = WhitePixel(disp, scr);
-    static unsigned long redPixel = WhitePixel(disp, scr);
-    static unsigned long yellowPixel = WhitePixel(disp, scr);
-    if (!colorsInit)
-    {
-        Colormap colormap = DefaultColormap(disp, scr);
-        XColor green, white, red, yellow, exact;
-
-        if (XAllocNamedColor(disp, colormap, "green", &green, &exact))
-            greenPixel = green.pixel;
-
-        if (XAllocNamedColor(disp, colormap, "white", &white, &exact))
-            whitePixel = white.pixel;
+    // colours (0xRRGGBB)
+    const unsigned long greenRgb = 0x00FF00;
+    const unsigned long whiteRgb = 0xFFFFFF;
+    const unsigned long redRgb = 0xFF0000;
+    const unsigned long yellowRgb = 0xFFFF00;
+    const unsigned long orangeRgb = 0xFFA500;
 
-        if (XAllocNamedColor(disp, colormap, "red", &red, &exact))
-            redPixel = red.pixel;
+    // scrollback rows (cached)
+    updateWrapCache(T, R.cellW(), maxW);
 
-        if (XAllocNamedColor(disp, colormap, "yellow", &yellow, &exact))
-            yellowPixel = yellow.pixel;
-
-        colorsInit = true;
+    // Overlay lines: a fixed prefix followed by a range of the input. Nothing
+    // is copied out of the gap buffer except the rows that end up on screen.
+    struct overlayLine
+    {
+        string prefix;
+        size_t from, to; // range of T.input
+    };
+    vector<overlayLine> overlay;
+    size_t cursorLine = 0, cursorCol = 0;
+    if (!T.watching && !T.fg.pgid)
+    {
+        size_t cur = min((size_t)max(0, T.currentCursorPosition), T.input.size());
+        if (T.recommFlag || T.searchFlag)
+        {
+            if (T.recommFlag)
+            {
+                // the line being completed stays visible above the options
+                string prompt = promptFor(T);
+                size_t last = 0, nl;
+                while ((nl = T.forRec.find('\n', last)) != string::npos)
+                {
+                    overlay.push_back({(last == 0 ? prompt : "") + T.forRec.substr(last, nl - last), 0, 0});
+                    last = nl + 1;
+                }
+                overlay.push_back({(last == 0 ? prompt : "") + T.forRec.substr(last), 0, 0});
+                overlay.push_back({"REC:" + T.showRec, 0, 0});
+            }
+            string label = T.recommFlag ? "REC:Choose from above options:" : "REC:Enter search term:";
+            overlay.push_back({label, 0, T.input.size()});
+            cursorLine = overlay.size() - 1;
+            cursorCol = label.size() + cur;
+        }
+        else
+        {
+            for (size_t l = 0; l < T.input.lineCount(); ++l)
+                overlay.push_back({l == 0 ? promptFor(T) : string(), T.input.lineStart(l), T.input.lineEnd(l)});
+            cursorLine = T.input.lineOf(cur);
+            cursorCol = overlay[cursorLine].prefix.size() + cur - T.input.lineStart(cursorLine);
+        }
+        if (!T.statusLine.empty())
+            overlay.push_back({T.statusLine, 0, 0});
+    }
+    if (T.filterEditing || T.filter.active())
+    {
+        string label = "REC:Filter: " + T.filter.pattern;
+        string info;
+        if (!T.filter.error.empty())
+            info = T.filter.error;
+        else if (T.filter.active())
+            info = to_string(T.filter.view.size()) + " of " + to_string(T.displayBuffer.size()) + " lines";
+        if (!T.filterEditing)
+            info += info.empty() ? "Ctrl+Shift+G to edit" : ", Ctrl+Shift+G to edit";
+        overlay.push_back({label + (info.empty() ? "" : "    [" + info + "]"), 0, 0});
+        if (T.filterEditing)
+        {
+            cursorLine = overlay.size() - 1;
+            cursorCol = label.size();
+        }
+    }
+    if (T.findFlag)
+    {
+        string label = "REC:Find: " + T.findQuery;
+        string info;
+        if (T.findScanning)
+            info = "searching...";
+        else if (!T.findQuery.empty())
+            info = T.findHits.empty() ? "no matches"
+                                      : to_string(T.findCurrent + 1) + "/" + to_string(T.findHits.size());
+        overlay.push_back({label + (info.empty() ? "" : "    [" + info + "]"), 0, 0});
+        cursorLine = overlay.size() - 1;
+        cursorCol = label.size();
     }
 
-    const string defaultPrefix = "shre@Term:";
-
-    struct dispLine
+    auto overlayChar = [&](const overlayLine &ol, size_t k)
     {
-        string text;
-        int promptChars;
+        return k < ol.prefix.size() ? ol.prefix[k] : T.input[ol.from + k - ol.prefix.size()];
     };
-    vector<dispLine> dispLines;
-
-    for (const auto &orgLine : T.displayBuffer)
+    auto overlayText = [&](const overlayLine &ol, size_t start, size_t len)
     {
-        if (orgLine.empty())
+        string out;
+        if (start < ol.prefix.size())
+            out = ol.prefix.substr(start, len);
+        if (out.size() < len)
         {
-            dispLines.push_back({"", 0});
-            continue;
+            size_t from = ol.from + (start + out.size() - ol.prefix.size());
+            out += T.input.substr(from, len - out.size());
         }
+        return out;
+    };
 
-        size_t pos = 0;
-        while (pos < orgLine.size())
+    struct overlayRow
+    {
+        size_t line, start, len;
+        int promptChars;
+    };
+    vector<overlayRow> overRows;
+    size_t cursorRow = 0;
+    vector<pair<size_t, size_t>> pieces;
+    for (size_t i = 0; i < overlay.size(); ++i)
+    {
+        const overlayLine &ol = overlay[i];
+        size_t n = ol.prefix.size() + (ol.to - ol.from);
+        bool ascii = (ol.to == ol.from || T.input.highBytes == 0) &&
+                     none_of(ol.prefix.begin(), ol.prefix.end(), [](char c) { return (unsigned char)c >= 0x80; });
+        pieces.clear();
+        wrapRowsOf(n, [&](size_t k) { return overlayChar(ol, k); }, R.cellW(), maxW, pieces, ascii);
+        bool isPrompt = ol.prefix.rfind(promptPrefix, 0) == 0;
+        for (size_t p = 0; p < pieces.size(); ++p)
         {
-            int curWidth = 0;
-            size_t start = pos;
-            size_t len = 0;
-
-            for (; pos < orgLine.size(); ++pos)
-            {
-                char c = orgLine[pos];
-                int cw = XTextWidth(font, &c, 1);
-                if (curWidth + cw > winWidth - marginLeft - 10)
-                    break;
-                curWidth += cw;
-                ++len;
-            }
-
-            if (len == 0)
-            {
-                ++pos;
-                ++len;
-            }
-
-            string piece = orgLine.substr(start, len);
-            int findInPiece = 0;
-            if (start == 0 && orgLine.rfind(defaultPrefix, 0) == 0)
-                findInPiece = (int)min<size_t>(len, defaultPrefix.size());
-
-            dispLines.push_back({piece, findInPiece});
+            auto [start, len] = pieces[p];
+            // the cursor sits on the row holding its column (the last row at the end of a line)
+            if (i == cursorLine && cursorCol >= start && (cursorCol < start + len || p + 1 == pieces.size()))
+                cursorRow = overRows.size();
+            overRows.push_back({i, start, len, (start == 0 && isPrompt) ? (int)min(len, promptPrefix.size()) : 0});
         }
     }
 
     int seeRows = max(1, (winHeight - marginTop) / lineH);
 
-    int alllines = (int)dispLines.size();
+    int bufRows = (int)T.wrapRows.size();
+    int alllines = bufRows + (int)overRows.size();
     if (T.scrlOffset < 0)
         T.scrlOffset = 0;
     if (T.scrlOffset > max(0, alllines - seeRows))
@@ -186,268 +403,322 @@ static int makeScreen(Window win, GC gc, XFontStruct *font,
     int start = T.scrlOffset;
     int end = min(alllines, T.scrlOffset + seeRows);
 
-    for (int row = start; row < end; ++row)
+    // text of a screen row, its colour, and how many leading chars were dropped
+    auto rowText = [&](int row, unsigned long &color, size_t &skipped, int &promptChars)
     {
-        int y = marginTop + (row - start) * lineH;
-        int x = marginLeft;
-        const dispLine &dl = dispLines[row];
-
-        unsigned long color = whitePixel;
-        string drawText = dl.text;
-
-        if (drawText.rfind("ERROR:", 0) == 0)
+        string text;
+        if (row < bufRows)
         {
-            color = redPixel;
-            drawText = drawText.substr(7);
+            const wrapRow &wr = T.wrapRows[row];
+            text = T.displayBuffer[wr.line].substr(wr.start, wr.len);
+            promptChars = wr.promptChars;
         }
-        if (drawText.rfind("REC:", 0) == 0)
+        else
         {
-            color = yellowPixel;
-            drawText = drawText.substr(4);
+            const overlayRow &orow = overRows[row - bufRows];
+            text = overlayText(overlay[orow.line], orow.start, orow.len);
+            promptChars = orow.promptChars;
         }
 
-        if (dl.promptChars > 0)
+        color = whiteRgb;
+        skipped = 0;
+        if (text.rfind("ERROR:", 0) == 0)
         {
-            string ppart = drawText.substr(0, dl.promptChars);
-            XSetForeground(disp, gc, greenPixel);
-            XDrawString(disp, win, gc, x, y, ppart.c_str(), (int)ppart.length());
-            x += XTextWidth(font, ppart.c_str(), (int)ppart.length());
-
-            string rpart = drawText.substr(dl.promptChars);
-            if (!rpart.empty())
-            {
-                XSetForeground(disp, gc, color);
-                XDrawString(disp, win, gc, x, y, rpart.c_str(), (int)rpart.length());
-            }
+            color = redRgb;
+            skipped = min<size_t>(7, text.size());
         }
-        else
+        if (text.rfind("REC:", 0) == 0)
         {
-            XSetForeground(disp, gc, color);
-            XDrawString(disp, win, gc, x, y, drawText.c_str(), (int)drawText.length());
+            color = yellowRgb;
+            skipped = 4;
         }
-    }
+        return text.substr(skipped);
+    };
 
-    // Cursor
-    if (T.dispCursor)
+    for (int row = start; row < end; ++row)
     {
-        string sdisp = editPWD(T.cwd);
-        string prompt = (sdisp == "/") ? "shre@Term:" + sdisp + "$ " : "shre@Term:~" + sdisp + "$ ";
+        int y = marginTop + (row - start) * lineH;
+        int x = marginLeft;
 
-        vector<string> lines;
-        size_t pos = 0, last = 0;
-        while ((pos = T.input.find('\n', last)) != string::npos)
+        unsigned long color;
+        size_t skipped;
+        int promptChars;
+        string drawText = rowText(row, color, skipped, promptChars);
+
+        if (promptChars > 0)
         {
-            lines.push_back(T.input.substr(last, pos - last));
-            last = pos + 1;
+            x += R.drawText(x, y, drawText.data(), min<size_t>(promptChars, drawText.size()), greenRgb);
+            if (drawText.size() > (size_t)promptChars)
+                R.drawText(x, y, drawText.data() + promptChars, drawText.size() - promptChars, color);
         }
-        lines.push_back(T.input.substr(last));
+        else
+            R.drawText(x, y, drawText.data(), drawText.size(), color);
 
-        int curLine = 0, curCol = T.currentCursorPosition;
-        int counted = 0;
-        for (size_t i = 0; i < lines.size(); i++)
+        // find matches on this row: filled box, text redrawn in black
+        if (row < bufRows && !T.findHits.empty())
         {
-            if (T.currentCursorPosition <= counted + (int)lines[i].size())
+            R.flush();
+            const wrapRow &wr = T.wrapRows[row];
+            size_t qlen = T.findQuery.size();
+            auto it = lower_bound(T.findHits.begin(), T.findHits.end(),
+                                  make_pair(wr.line, wr.start >= qlen ? wr.start - qlen + 1 : 0));
+            for (; it != T.findHits.end() && it->first == wr.line && it->second < wr.start + wr.len; ++it)
             {
-                curLine = (int)i;
-                curCol = T.currentCursorPosition - counted;
-                break;
+                size_t from = max(it->second, wr.start + skipped);
+                size_t to = min(it->second + qlen, wr.start + wr.len);
+                if (from >= to)
+                    continue;
+                size_t col = from - wr.start - skipped;
+                const char *s = drawText.c_str() + col;
+                int hx = marginLeft + R.textWidth(drawText.c_str(), col);
+                int hw = R.textWidth(s, to - from);
+                bool current = (it - T.findHits.begin()) == T.findCurrent;
+                R.fillRect(hx, y - R.ascent(), hw, lineH, current ? orangeRgb : yellowRgb);
+                R.drawText(hx, y, s, to - from, 0x000000);
             }
-            counted += (int)lines[i].size() + 1;
         }
+    }
+
+    R.flush();
+
+    // Cursor
+    int cursorLineIdx = bufRows + (int)cursorRow;
+    if (T.dispCursor && !overRows.empty() && cursorLineIdx >= start && cursorLineIdx < end)
+    {
+        unsigned long color;
+        size_t skipped;
+        int promptChars;
+        string drawText = rowText(cursorLineIdx, color, skipped, promptChars);
+        size_t col = cursorCol - overRows[cursorRow].start;
+        col = (col > skipped) ? col - skipped : 0;
+        int pxWidth = R.textWidth(drawText.c_str(), min(col, drawText.size()));
+
+        int cursorX = marginLeft + pxWidth;
+        int row = cursorLineIdx - start;
+        int baselineY = marginTop + row * lineH;
+        int yTop = baselineY - R.ascent();
+        int yBottom = baselineY + R.descent();
+
+        R.drawLine(cursorX, yTop, cursorX, yBottom, whiteRgb);
+    }
+
+    // termstat overlay, in the gap between the navbar and the first row
+    if (latencyOverlay)
+    {
+        string stat = latencySummary();
+        int w = R.textWidth(stat.data(), stat.size());
+        int ox = winWidth - w - 10;
+        int oy = NAVBAR_H + 4;
+        R.fillRect(ox - 4, oy, w + 8, lineH, 0x000000);
+        R.drawText(ox, oy + R.ascent(), stat.data(), stat.size(), yellowRgb);
+        R.flush();
+    }
+    latencyDrawn();
+    counters.screenCalls++;
+    counters.screenUs += usSince(started);
 
-        string uptoCursor;
-        int pxWidth = 0;
+    return alllines;
+}
 
-        if (curLine == 0)
+vector<string> renderBench(renderer &R, tabState &T, const string &arg)
+{
+    int frames = arg.empty() ? 200 : atoi(arg.c_str());
+    if (frames <= 0)
+        return {"Usage: renderbench [frames]"};
+
+    xRenderer *X = dynamic_cast<xRenderer *>(&R);
+    int lineH = R.lineH();
+    int seeRows = max(1, (winGeom.height - (NAVBAR_H + 30)) / lineH);
+    int savedOffset = T.scrlOffset;
+    bool savedAtlas = X && X->font->useAtlas;
+    int total = makeScreen(R, T);
+
+    vector<string> out;
+    out.push_back("renderbench: " + to_string(frames) + " frames, " + to_string(winGeom.width) + "x" +
+                  to_string(winGeom.height) + ", " + to_string(total) + " rows");
+    for (int atlas = 0; atlas < (X ? 2 : 1); ++atlas)
+    {
+        if (X && atlas && !initAtlas(X->font, X->win))
         {
-            if (T.searchFlag)
-            {
-                string searchPrompt = "Enter search term:";
-                int promptWidth = XTextWidth(font, searchPrompt.c_str(), searchPrompt.size());
-                uptoCursor = lines[curLine].substr(0, curCol);
-                int textWidth = XTextWidth(font, uptoCursor.c_str(), uptoCursor.size());
-                pxWidth = promptWidth + textWidth;
-            }
-            else if (T.recommFlag)
-            {
-                string searchPrompt = "Choose from above options:";
-                int promptWidth = XTextWidth(font, searchPrompt.c_str(), searchPrompt.size());
-                uptoCursor = lines[curLine].substr(0, curCol);
-                int textWidth = XTextWidth(font, uptoCursor.c_str(), uptoCursor.size());
-                pxWidth = promptWidth + textWidth;
-            }
-            else
-            {
-                uptoCursor = prompt + lines[curLine].substr(0, curCol);
-                pxWidth = XTextWidth(font, uptoCursor.c_str(), uptoCursor.size());
-            }
+            out.push_back("  atlas: RENDER extension not available");
+            continue;
         }
-        else
+        if (X)
         {
-            uptoCursor = lines[curLine].substr(0, curCol);
-            pxWidth = XTextWidth(font, uptoCursor.c_str(), uptoCursor.size());
+            X->font->useAtlas = atlas;
+            XSync(disp, False);
         }
-
-        int contentYOffset = NAVBAR_H + 30;
-        int marginLeftX = 10;
-        int cursorX = marginLeftX + pxWidth;
-        int cursorLineIdx = alllines - ((int)lines.size() - curLine);
-
-        if (cursorLineIdx >= start && cursorLineIdx < end)
+        auto t0 = chrono::steady_clock::now();
+        for (int i = 0; i < frames; ++i)
         {
-            int row = cursorLineIdx - start;
-            int baselineY = contentYOffset + row * lineH;
-            int yTop = baselineY - font->ascent;
-            int yBottom = baselineY + font->descent;
-
-            XSetForeground(disp, gc, WhitePixel(disp, scr));
-            XDrawLine(disp, win, gc, cursorX, yTop, cursorX, yBottom);
+            // a new screenful every frame, like fast-scrolling output
+            T.scrlOffset = (total > seeRows) ? (i * seeRows) % (total - seeRows + 1) : 0;
+            makeScreen(R, T);
         }
+        if (X)
+            XSync(disp, False);
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+        ostringstream line;
+        line << fixed << setprecision(1) << "  " << (!X ? "framebuffer" : atlas ? "atlas" : "xft") << ": "
+             << (secs > 0 ? frames / secs : 0.0) << " fps (" << secs * 1000.0 / frames << " ms/frame)";
+        out.push_back(line.str());
     }
-
-    return (int)dispLines.size();
+    if (X)
+        X->font->useAtlas = savedAtlas;
+    T.scrlOffset = savedOffset;
+    return out;
 }
 
 // navbar drawing
-static void makeNavBar(Window win, GC gc, int windowW)
+void makeNavBar(renderer &R, int windowW)
 {
-    XSetForeground(disp, gc, BlackPixel(disp, scr));
-    XFillRectangle(disp, win, gc, 0, 0, windowW, NAVBAR_H);
-
-    XSetForeground(disp, gc, WhitePixel(disp, scr));
-    XDrawLine(disp, win, gc, 0, NAVBAR_H - 1, windowW, NAVBAR_H - 1);
+    R.fillRect(0, 0, windowW, NAVBAR_H, 0x000000);
+    R.drawLine(0, NAVBAR_H - 1, windowW, NAVBAR_H - 1, 0xFFFFFF);
 }
 
-// Globals to track hover state (set these from MotionNotify handler)
 int howerXClose = -1;
 bool howerPlusTab = false;
 
-static vector<tabPosNavbar> makeTabs(Window win, GC gc, XFontStruct *font)
-{
-    XWindowAttributes wa;
-    XGetWindowAttributes(disp, win, &wa);
-    int windowW = wa.width;
+// Navbar layout, recomputed only when the tab count or window width changes;
+// hit-testing and hover repaints use it without touching the server.
+static vector<tabPosNavbar> tabLayout;
+static int tabLayoutW = -1; // width tabLayout was computed for
 
-    vector<tabPosNavbar> pos;
+static const int TAB_Y = 6;
+static const int TAB_RAD = 10;
+static const int PLUS_W = 50;
 
-    // Close window if no tabs
-    if (tabs.empty())
-    {
-        XDestroyWindow(disp, win);
-        XCloseDisplay(disp);
-        exit(0);
-    }
+const vector<tabPosNavbar> &navbarLayout()
+{
+    int navbarW = winGeom.width;
+    if (tabLayoutW == navbarW && tabLayout.size() == tabs.size() + 1)
+        return tabLayout;
 
-    int y = 6;
-    int tabH = NAVBAR_H - 10;
-    int rad = 10;
+    tabLayout.clear();
     int gap = 6;
+    int closeSize = 18;
 
     // Reserve space for "+" button
-    int plusW = 50;
-    int availableW = windowW - plusW - (gap * (int)tabs.size()) - 20;
+    int availableW = navbarW - PLUS_W - (gap * (int)tabs.size()) - 20;
     int totalTabs = max(1, (int)tabs.size());
     int tabW = availableW / totalTabs;
 
     for (size_t i = 0; i < tabs.size(); ++i)
     {
-        string label = "TAB " + to_string((int)i + 1);
         int x = 10 + i * (tabW + gap);
-        bool active = ((int)i == tabActive);
-
-        unsigned long activeBg = 0xF7F9FF;
-        unsigned long inactiveBg = 0x2C2F36;
-        unsigned long activeText = 0x202020;
-        unsigned long inactiveText = 0xEAEAEA;
-        unsigned long borderColor = 0x000000;
-
-        unsigned long bg = active ? activeBg : inactiveBg;
-        unsigned long textc = active ? activeText : inactiveText;
-
-        // Tab background
-        XSetForeground(disp, gc, bg);
-        XFillArc(disp, win, gc, x, y, rad * 2, rad * 2, 90 * 64, 90 * 64);
-        XFillArc(disp, win, gc, x + tabW - rad * 2, y, rad * 2, rad * 2, 0, 90 * 64);
-        XFillRectangle(disp, win, gc, x + rad, y, tabW - 2 * rad, tabH);
-        XFillRectangle(disp, win, gc, x, y + rad, tabW, tabH - rad);
-
-        // Active tab indicator
-        if (active)
-        {
-            XSetForeground(disp, gc, 0xFF0000);
-            XFillRectangle(disp, win, gc, x, y + tabH - 3, tabW, 3);
-        }
+        int xClose = x + tabW - closeSize - 8;
+        tabLayout.push_back({x, tabW, xClose, closeSize, false});
+    }
+    int plusX = navbarW - PLUS_W - 10;
+    tabLayout.push_back({plusX, PLUS_W, plusX, PLUS_W, true});
+    tabLayoutW = navbarW;
+    return tabLayout;
+}
 
-        // Border
-        XSetForeground(disp, gc, borderColor);
-        XDrawRectangle(disp, win, gc, x, y, tabW - 1, tabH);
+// Paint one tab over its own rectangle (the navbar background included, so
+// it can be repainted alone when its hover state changes).
+static void drawTab(renderer &R, int i)
+{
+    const tabPosNavbar &tp = navbarLayout()[i];
+    int x = tp.x;
+    int tabW = tp.w;
+    int y = TAB_Y;
+    int tabH = NAVBAR_H - 10;
+    int rad = TAB_RAD;
 
-        // Label text
-        XCharStruct fullTab;
-        int dir, ascent, descent;
-        XTextExtents(font, label.c_str(), (int)label.size(), &dir, &ascent, &descent, &fullTab);
+    string label = "TAB " + to_string(i + 1);
+    bool active = (i == tabActive);
 
-        int textX = x + (tabW - fullTab.width) / 2;
-        int textY = y + (tabH + ascent - descent) / 2 + 2;
+    unsigned long activeBg = 0xF7F9FF;
+    unsigned long inactiveBg = 0x2C2F36;
+    unsigned long activeText = 0x202020;
+    unsigned long inactiveText = 0xEAEAEA;
+    unsigned long borderColor = 0x000000;
 
-        XSetForeground(disp, gc, textc);
-        XDrawString(disp, win, gc, textX, textY, label.c_str(), (int)label.size());
+    unsigned long bg = active ? activeBg : inactiveBg;
+    unsigned long textc = active ? activeText : inactiveText;
 
-        // Close button
-        int closeSize = 18;
-        int xClose = x + tabW - closeSize - 8;
-        int closeY = y + (tabH - closeSize) / 2;
+    R.fillRect(x, y, tabW, tabH + 1, 0x000000);
 
-        unsigned long closeBg = (howerXClose == (int)i) ? 0xC0392B : (active ? 0xE74C3C : 0x555555);
-        unsigned long close_fg = 0xFFFFFF;
+    // Tab background
+    R.fillArc(x, y, rad * 2, rad * 2, 90 * 64, 90 * 64, bg);
+    R.fillArc(x + tabW - rad * 2, y, rad * 2, rad * 2, 0, 90 * 64, bg);
+    R.fillRect(x + rad, y, tabW - 2 * rad, tabH, bg);
+    R.fillRect(x, y + rad, tabW, tabH - rad, bg);
 
-        XSetForeground(disp, gc, closeBg);
-        XFillArc(disp, win, gc, xClose, closeY, closeSize, closeSize, 0, 360 * 64);
+    // Active tab indicator
+    if (active)
+    {
+        R.fillRect(x, y + tabH - 3, tabW, 3, 0xFF0000);
+    }
 
-        // Centered "X"
-        string cross = "x";
-        XCharStruct cross_fullTab;
-        int dir2, ascent2, descent2;
-        XTextExtents(font, cross.c_str(), cross.size(), &dir2, &ascent2, &descent2, &cross_fullTab);
+    // Border
+    R.drawRect(x, y, tabW - 1, tabH, borderColor);
 
-        int cx = xClose + (closeSize - cross_fullTab.width) / 2;
-        int cy = closeY + (closeSize + ascent2 - descent2) / 2;
-        XSetForeground(disp, gc, close_fg);
-        XDrawString(disp, win, gc, cx, cy, cross.c_str(), (int)cross.size());
+    // Label text
+    int textX = x + (tabW - R.textWidth(label.c_str(), label.size())) / 2;
+    int textY = y + (tabH + R.ascent() - R.descent()) / 2 + 2;
+    R.drawText(textX, textY, label.c_str(), label.size(), textc);
 
-        pos.push_back({x, tabW, xClose, closeSize, false});
-    }
+    // Close button
+    int closeSize = tp.wClose;
+    int xClose = tp.xClose;
+    int closeY = y + (tabH - closeSize) / 2;
 
-    // "+" button
-    int plusX = windowW - plusW - 10;
-    int plusY = y;
+    unsigned long closeBg = (howerXClose == i) ? 0xC0392B : (active ? 0xE74C3C : 0x555555);
+    unsigned long close_fg = 0xFFFFFF;
+
+    R.fillArc(xClose, closeY, closeSize, closeSize, 0, 360 * 64, closeBg);
+
+    // Centered "X"
+    string cross = "x";
+    int cx = xClose + (closeSize - R.textWidth(cross.c_str(), cross.size())) / 2;
+    int cy = closeY + (closeSize + R.ascent() - R.descent()) / 2;
+    R.drawText(cx, cy, cross.c_str(), cross.size(), close_fg);
+    R.flush();
+}
+
+static void drawPlusTab(renderer &R)
+{
+    const tabPosNavbar &tp = navbarLayout().back();
+    int plusX = tp.x;
+    int plusY = TAB_Y;
+    int plusW = tp.w;
+    int tabH = NAVBAR_H - 10;
+    int rad = TAB_RAD;
     unsigned long plusBg = howerPlusTab ? 0x1E8449 : 0x27AE60; // darker on hover
 
-    XSetForeground(disp, gc, plusBg);
-    XFillArc(disp, win, gc, plusX, plusY, rad * 2, rad * 2, 90 * 64, 90 * 64);
-    XFillArc(disp, win, gc, plusX + plusW - rad * 2, plusY, rad * 2, rad * 2, 0, 90 * 64);
-    XFillRectangle(disp, win, gc, plusX + rad, plusY, plusW - 2 * rad, tabH);
-    XFillRectangle(disp, win, gc, plusX, plusY + rad, plusW, tabH - rad);
+    R.fillRect(plusX, plusY, plusW, tabH + 1, 0x000000);
 
-    XSetForeground(disp, gc, 0x000000);
-    XDrawRectangle(disp, win, gc, plusX, plusY, plusW - 1, tabH);
+    R.fillArc(plusX, plusY, rad * 2, rad * 2, 90 * 64, 90 * 64, plusBg);
+    R.fillArc(plusX + plusW - rad * 2, plusY, rad * 2, rad * 2, 0, 90 * 64, plusBg);
+    R.fillRect(plusX + rad, plusY, plusW - 2 * rad, tabH, plusBg);
+    R.fillRect(plusX, plusY + rad, plusW, tabH - rad, plusBg);
+
+    R.drawRect(plusX, plusY, plusW - 1, tabH, 0x000000);
 
     // Centered "+"
     string plus = "+";
-    XCharStruct pFullTab;
-    int dir_p, ascent_p, descent_p;
-    XTextExtents(font, plus.c_str(), (int)plus.size(), &dir_p, &ascent_p, &descent_p, &pFullTab);
-
-    int px = plusX + (plusW - pFullTab.width) / 2;
-    int py = plusY + (tabH + ascent_p - descent_p) / 2 + 2;
-    XDrawString(disp, win, gc, px, py, plus.c_str(), (int)plus.size());
+    int px = plusX + (plusW - R.textWidth(plus.c_str(), plus.size())) / 2;
+    int py = plusY + (tabH + R.ascent() - R.descent()) / 2 + 2;
+    R.drawText(px, py, plus.c_str(), plus.size(), 0x000000);
+    R.flush();
+}
 
-    pos.push_back({plusX, plusW, plusX, plusW, true});
+const vector<tabPosNavbar> &makeTabs(renderer &R)
+{
+    TRACE_SCOPE("makeTabs");
+    // Close window if no tabs (the server drops it with the connection)
+    if (tabs.empty())
+        exit(0);
 
-    return pos;
+    for (int i = 0; i < (int)tabs.size(); ++i)
+        drawTab(R, i);
+    drawPlusTab(R);
+    return navbarLayout();
 }
 
-int navbarHit(int mx, int my, const vector<tabPosNavbar> &pos, int *outIdx = nullptr)
+int navbarHit(int mx, int my, const vector<tabPosNavbar> &pos, int *outIdx)
 {
 
     for (size_t i = 0; i < pos.size(); ++i)
@@ -482,16 +753,36 @@ int navbarHit(int mx, int my, const vector<tabPosNavbar> &pos, int *outIdx = nul
     return -1; // nothing
 }
 
-// add new tab
-static void addTab(const string &initial_cwd = "/")
+void navbarHover(renderer &R, int mx, int my)
+{
+    int idx = -1;
+    int hit = (my >= 0 && my < NAVBAR_H) ? navbarHit(mx, my, navbarLayout(), &idx) : -1;
+    int newClose = (hit == -3) ? idx : -1;
+    bool newPlus = (hit == -2);
+
+    int oldClose = howerXClose;
+    bool oldPlus = howerPlusTab;
+    howerXClose = newClose;
+    howerPlusTab = newPlus;
+
+    if (oldClose != newClose)
+    {
+        if (oldClose >= 0 && oldClose < (int)tabs.size())
+            drawTab(R, oldClose);
+        if (newClose >= 0)
+            drawTab(R, newClose);
+    }
+    if (oldPlus != newPlus && !tabs.empty())
+        drawPlusTab(R);
+}
+
+void addTab(const string &initial_cwd)
 {
     tabState t;
     t.cwd = initial_cwd;
-    string sdisp = editPWD(t.cwd);
-    string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-    t.displayBuffer.push_back(prompt);
-    t.inpIdx = (int)inputs.size() - 1;
+    t.inpIdx = historyLoading() ? 0 : (int)inputs.size() - 1; // set again once loaded
     t.title = "Tab " + to_string((int)tabs.size() + 1);
+    t.id = nextTabId++;
     tabs.push_back(std::move(t));
     tabActive = (int)tabs.size() - 1;
 }
@@ -0,0 +1,279 @@
+#pragma once
+#include "render.h"
+#include "atlas.h"
+#include "inputbuf.h"
+#include "filter.h"
+
+//  Tabs, the screen and the navbar (draw.cpp)
+
+extern Display *disp;
+extern int scr;
+extern Window root;
+
+// Window size as last reported by ConfigureNotify. Drawing and scrolling
+// read it from here instead of asking the server on every keystroke.
+struct winGeometry
+{
+    int width = 0;
+    int height = 0;
+};
+extern winGeometry winGeom;
+
+// Atoms are interned once at startup (one round-trip for all of them).
+extern Atom atomClipboard;
+extern Atom atomUtf8String;
+extern Atom atomPasteBuffer;
+extern Atom atomIncr;
+void internAtoms();
+
+// Round-trip audit (SHRETERM_X11_AUDIT=1, only in builds made with make
+// X11_AUDIT=1): replies waited for so far, and whether to report them.
+unsigned long x11RoundTrips();
+bool x11AuditEnabled();
+
+// Drawing on the terminal window.
+struct xRenderer : renderer
+{
+    Window win;
+    GC gc;
+    textFont *font;
+
+    xRenderer(Window w, GC g, textFont *f) : win(w), gc(g), font(f) {}
+
+    int ascent() const override { return font->ascent; }
+    int descent() const override { return font->descent; }
+    int cellW() const override { return font->cellW; }
+
+    void setColor(unsigned long rgb) { XSetForeground(font->dpy, gc, textColor(font, rgb)->pixel); }
+
+    void clear(int x, int y, int w, int h) override
+    {
+        XClearArea(font->dpy, win, x, y, (unsigned)max(0, w), (unsigned)max(0, h), False);
+    }
+    void fillRect(int x, int y, int w, int h, unsigned long rgb) override
+    {
+        setColor(rgb);
+        XFillRectangle(font->dpy, win, gc, x, y, (unsigned)max(0, w), (unsigned)max(0, h));
+    }
+    void drawRect(int x, int y, int w, int h, unsigned long rgb) override
+    {
+        setColor(rgb);
+        XDrawRectangle(font->dpy, win, gc, x, y, (unsigned)max(0, w), (unsigned)max(0, h));
+    }
+    void fillArc(int x, int y, int w, int h, int angle1, int angle2, unsigned long rgb) override
+    {
+        setColor(rgb);
+        XFillArc(font->dpy, win, gc, x, y, (unsigned)max(0, w), (unsigned)max(0, h), angle1, angle2);
+    }
+    void drawLine(int x1, int y1, int x2, int y2, unsigned long rgb) override
+    {
+        setColor(rgb);
+        XDrawLine(font->dpy, win, gc, x1, y1, x2, y2);
+    }
+    int drawText(int x, int y, const char *s, size_t n, unsigned long rgb) override
+    {
+        return drawRun(font, x, y, s, n, rgb);
+    }
+    void flush() override { flushText(font); }
+
+    void requestPaste() override
+    {
+        XConvertSelection(font->dpy, atomClipboard, atomUtf8String, atomPasteBuffer, win, CurrentTime);
+    }
+};
+
+const int ROWS = 24; // kept (not directly used, but retained)
+#define POSX 200
+#define POSY 200
+#define WIDTH 900
+#define HEIGHT 600
+#define BORDER 8
+
+// navbar constants
+const int NAVBAR_H = 40;
+const int TAB_PADDING = 8;
+const int TAB_SPACING = 4;
+
+// one wrapped screen row of a displayBuffer line
+struct wrapRow
+{
+    size_t line;     // index into displayBuffer
+    size_t start;    // first byte of the row within that line
+    size_t len;
+    int promptChars; // leading chars drawn in the prompt colour
+};
+
+//  Per-tab state
+
+struct tabState
+{
+    // UI buffers / state
+    // displayBuffer is the scrollback only; the prompt and the input being
+    // edited are drawn below it as an overlay and appended (echoed) once the
+    // line is submitted.
+    vector<string> displayBuffer;
+    vector<string> oldBuffer;
+    gapBuffer input;
+    int currentCursorPosition = 0;
+    bool searchFlag = false;
+    bool recommFlag = false;
+    string showRec = "";
+    vector<string> recs;
+    string query = "";
+    string forRec = "";
+    int inpIdx = 0;
+    int scrlOffset = 0;
+    bool userScrolled = false;
+    bool multLineFlag = false;
+    int count = 0;
+    // cursor blink
+    bool dispCursor = true;
+    chrono::steady_clock::time_point lastBlink = chrono::steady_clock::now();
+    // per-tab cwd
+    string cwd = "/";
+    // title
+    string title;
+    // stable id; jobs, workers and pastes refer to the tab by it (tabById)
+    int id = 0;
+    // raw stdout log of foreground commands (teelog builtin), empty if off
+    string teeLogPath;
+    // exit status of the last command run by execInDir
+    int lastStatus = 0;
+    // a multiWatch owns the screen; no prompt overlay until it is stopped
+    bool watching = false;
+    // Command run from the prompt that owns the tab (no prompt overlay) until
+    // it finishes or is stopped; pgid is 0 when there is none.
+    struct foregroundCmd
+    {
+        pid_t pgid = 0;
+        bool resumed = false; // brought back by fg, already accounted for
+        string cmd, cwd;
+        chrono::steady_clock::time_point start;
+        bool recordHist = false;
+    } fg;
+    // transient line under the input (paste progress and the like), "" if none
+    string statusLine;
+    // Wrapped rows of displayBuffer. Lines are appended between redraws, so
+    // only new lines are wrapped; bufGen must be bumped whenever lines are
+    // removed or replaced, which forces a full rewrap.
+    vector<wrapRow> wrapRows;
+    size_t wrappedLines = 0;
+    int wrapWidth = -1;
+    uint64_t bufGen = 0;
+    uint64_t wrapGen = 0;
+    // find in scrollback: matches as (line, byte offset) in buffer order
+    bool findFlag = false;
+    string findQuery;
+    vector<pair<size_t, size_t>> findHits;
+    int findCurrent = -1;      // selected match, -1 if none
+    size_t findScanned = 0;    // lines of displayBuffer searched so far
+    uint64_t findGen = 0;      // bufGen the hits belong to
+    bool findScanning = false; // a background scan is running
+    // scrollback filter: when active only matching lines are shown
+    lineFilter filter;
+    bool filterEditing = false; // keys edit the filter pattern
+    uint64_t wrapViewGen = 0;   // filter.viewGen the wrap cache belongs to
+};
+
+// Replace (or clear) a tab's scrollback.
+void resetDisplay(tabState &T, vector<string> lines = {});
+// Submit the overlay: append the prompt and the input lines to scrollback,
+// the way they were shown while being edited.
+void echoInput(tabState &T, const string &suffix = "");
+
+// Open tabs in navbar order. Each tabState lives in its own heap block that
+// never moves: opening or closing a tab shifts pointers, never scrollback,
+// and a tabState& stays valid until that tab is closed. Anything that holds
+// on to a tab across events, or from another thread, keeps its id and looks
+// it up with tabById.
+struct tabList
+{
+    vector<unique_ptr<tabState>> order;
+    unordered_map<int, tabState *> ids;
+
+    struct iterator
+    {
+        vector<unique_ptr<tabState>>::const_iterator it;
+        tabState &operator*() const { return **it; }
+        iterator &operator++()
+        {
+            ++it;
+            return *this;
+        }
+        bool operator!=(const iterator &o) const { return it != o.it; }
+    };
+
+    size_t size() const { return order.size(); }
+    bool empty() const { return order.empty(); }
+    tabState &operator[](size_t i) const { return *order[i]; }
+    tabState &back() const { return *order.back(); }
+    iterator begin() const { return {order.begin()}; }
+    iterator end() const { return {order.end()}; }
+
+    void push_back(tabState &&t)
+    {
+        order.push_back(make_unique<tabState>(std::move(t)));
+        ids[order.back()->id] = order.back().get();
+    }
+    // Linear in the number of tabs, but only pointers move: the order is
+    // positional (tabActive, navbar hits and Ctrl+Tab go by index), so the
+    // tabs after a closed one each move up a place.
+    void erase(size_t i)
+    {
+        ids.erase(order[i]->id);
+        order.erase(order.begin() + (ptrdiff_t)i);
+    }
+    void clear()
+    {
+        order.clear();
+        ids.clear();
+    }
+};
+
+extern int tabActive;
+extern tabList tabs;
+
+// the tab with the given id, or nullptr if it was closed
+tabState *tabById(int id);
+// the tab on screen, or nullptr if there is none
+tabState *activeTab();
+
+// Latest multiWatch frame per tab id that has not been shown yet; the tab
+// takes it over when it is drawn.
+void postFrame(int tabId, vector<string> frame);
+bool framePending(int tabId);
+void applyPendingFrame(tabState &T);
+void dropPendingFrame(int tabId);
+
+struct tabPosNavbar
+{
+    int x;
+    int w;
+    int xClose;
+    int wClose;
+    bool isPlus;
+};
+
+const int SCROLL_STEP = 3; // lines per wheel/page step
+
+Window makeWindow(int x, int y, int h, int w, int b);
+// Draw T's scrollback and overlay; returns the number of wrapped rows.
+int makeScreen(renderer &R, tabState &T);
+// renderbench [frames]: repaint the tab while scrolling through it and report
+// frames per second. The X window is timed with each text path (server time
+// included), a headless framebuffer as it is.
+vector<string> renderBench(renderer &R, tabState &T, const string &arg);
+
+// navbar drawing
+void makeNavBar(renderer &R, int windowW);
+// Globals to track hover state (set these from MotionNotify handler)
+extern int howerXClose;
+extern bool howerPlusTab;
+const vector<tabPosNavbar> &navbarLayout();
+const vector<tabPosNavbar> &makeTabs(renderer &R);
+int navbarHit(int mx, int my, const vector<tabPosNavbar> &pos, int *outIdx = nullptr);
+// Pointer moved to (mx, my): update hover state and repaint only the
+// tab / "+" button whose highlight changed.
+void navbarHover(renderer &R, int mx, int my);
+// add new tab
+void addTab(const string &initial_cwd = "/");
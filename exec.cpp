@@ -1,66 +1,30 @@
-#include "headers.cpp"
-#include "draw.cpp"
+#include "exec.h"
+#include "sessionlog.h"
+#include "trace.h"
+#include "counters.h"
+#include "helper_funcs.h"
 
-// forward declarations
-struct tabState;
-extern vector<tabState> tabs;
+mutex mwQueueMutex;
+queue<watchMsg> mwQueue;
+vector<commandResult> commandResults;
 
-struct watchMsg { string text; int tabIdx; };
-static mutex mwQueueMutex;
-static queue<watchMsg> mwQueue;
+int uiWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
 
-
-// multiWatch stop requested by UI 
-atomic<bool> mwStopReq(false);
-atomic<bool> mwDone(false);
-atomic<bool> cmdRunning(false);
-
-// For interrupting arbitrary running commands
-static mutex currPidsMutex;
-static vector<pid_t> currChildPids; // guarded by currPidsMutex
-static atomic<bool> cmdUnderExec(false);
-
-// This is an async-safe request flag set by the UI (or by signal handler).
-// run-time loops will check this flag and kill children as soon as possible.
-static volatile sig_atomic_t sigintReqFlag = 0;
-
-// Called by your UI (run.cpp) when user presses Ctrl+C; keeps it async-safe.
-extern "C" void getSigint()
+void wakeUi()
 {
-    // Request stop of multiWatch and other loops
-    mwStopReq.store(true);
+    uint64_t one = 1;
+    if (write(uiWakeFd, &one, sizeof(one)) < 0) {}
+}
 
-    // Set the async flag to be handled by handle_pending_sigint()
-    sigintReqFlag = 1;
 
-    // Also proactively kill any recorded child pids (best-effort, non-blocking)
-    {
-        lock_guard<mutex> lk(currPidsMutex);
-        for (pid_t p : currChildPids)
-        {
-            if (p > 0)
-                kill(p, SIGINT);
-        }
-    }
-}
+chrono::milliseconds mwRefresh(2000);
 
-// A helper executed in runtime loops to handle an outstanding sigintReqFlag.
-// It is safe to call from normal code (not from signal handler).
-static void handleSigintLeft()
+extern "C" void getSigint(int tabId)
 {
-    if (sigintReqFlag == 0) return;
-    // clear the flag atomically
-    sigintReqFlag = 0;
-
-    // Kill all children we've recorded
-    lock_guard<mutex> lk(currPidsMutex);
-    for (pid_t p : currChildPids)
-    {
-        if (p > 0)
-            kill(p, SIGINT);
-    }
-    // Leave currChildPids in place until parent reaps/waits them.
+    stopWatch(tabId);
+    signalForeground(tabId, SIGINT);
 }
+
 vector<string> execCommand(const string &cmd)
 {
     if (cmd.empty())
@@ -130,10 +94,13 @@ vector<string> execCommand(const string &cmd)
     {
         pid_t pid = fork();
         if (pid < 0) { forkError = true; break; }
+        if (pid > 0) counters.forks++;
 
         if (pid == 0)
         {
             // child
+            setpgid(0, pids.empty() ? 0 : pids[0]);
+            resetChildSignals();
             if (i > 0)
             {
                 int in_fd = chainFds[(i-1)*2];
@@ -163,6 +130,8 @@ vector<string> execCommand(const string &cmd)
         }
         else
         {
+            pid_t pgid = pids.empty() ? 0 : pids[0];
+            joinJobGroup(pid, pgid);
             pids.push_back(pid);
         }
     }
@@ -181,12 +150,8 @@ vector<string> execCommand(const string &cmd)
     close(capture_out[1]);
     close(capture_err[1]);
 
-    // Record pids so UI-triggered interrupts can kill them.
-    {
-        lock_guard<mutex> lk(currPidsMutex);
-        currChildPids = pids;
-        cmdUnderExec.store(true);
-    }
+    // Record the pipeline (not owned by any tab) so it shows up in the job table.
+    registerJob(0, pids[0], pids, stripped, false, true, false);
 
     // read both pipes with poll
     string opBuffer, errBuffer;
@@ -198,11 +163,8 @@ vector<string> execCommand(const string &cmd)
     int active = 2;
     while (active > 0)
     {
-        // check for UI-requested SIGINT and handle it (kill children)
-        handleSigintLeft();
-
         int r = poll(pfds, 2, -1);
-        if (r < 0) { if (errno==EINTR) { handleSigintLeft(); continue; } break; }
+        if (r < 0) { if (errno==EINTR) continue; break; }
         for (int i = 0; i < 2; ++i)
         {
             if (pfds[i].fd < 0) continue;
@@ -249,12 +211,7 @@ vector<string> execCommand(const string &cmd)
         }
     }
 
-    // clear current child list
-    {
-        lock_guard<mutex> lk(currPidsMutex);
-        currChildPids.clear();
-        cmdUnderExec.store(false);
-    }
+    forgetJob(0, pids[0]);
 
     // If anything was written to stderr, treat as error
     if (!errBuffer.empty()) hadError = true;
@@ -305,13 +262,254 @@ vector<string> execCommand(const string &cmd)
     return output;
 }
 
-// tab-aware exec: same as yours, but with per-tab CWD isolation
+// Capture reads use one large buffer per thread instead of 4 KiB on the stack.
+static const size_t CAPTURE_CHUNK = 256 * 1024;
+
+static char *captureBuffer()
+{
+    thread_local vector<char> buf(CAPTURE_CHUNK);
+    return buf.data();
+}
+
+// Bigger pipes mean fewer wakeups for chatty commands (capped by pipe-max-size).
+static void growPipe(int fd)
+{
+    fcntl(fd, F_SETPIPE_SZ, 1 << 20);
+}
+
+// Split n bytes into complete lines; the unfinished tail stays in carry.
+static void appendLines(vector<string> &lines, string &carry, const char *data, size_t n)
+{
+    const char *p = data, *end = data + n;
+    while (p < end)
+    {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        if (!nl) { carry.append(p, end - p); return; }
+        if (carry.empty()) lines.emplace_back(p, nl - p);
+        else
+        {
+            carry.append(p, nl - p);
+            lines.push_back(std::move(carry));
+            carry.clear();
+        }
+        p = nl + 1;
+    }
+}
+
+// Read one chunk from a capture pipe. With a log attached the chunk is first
+// duplicated in-kernel (tee) and spliced to the file, then exactly those bytes
+// are consumed by the read. A failing log is dropped, never the output.
+static ssize_t readCapture(int fd, char *buf, int &logFd, int *teePipe)
+{
+    size_t want = CAPTURE_CHUNK;
+    if (logFd >= 0)
+    {
+        ssize_t t = tee(fd, teePipe[1], CAPTURE_CHUNK, SPLICE_F_NONBLOCK);
+        if (t > 0)
+        {
+            ssize_t left = t;
+            while (left > 0)
+            {
+                ssize_t m = splice(teePipe[0], nullptr, logFd, nullptr, left, SPLICE_F_MOVE);
+                if (m <= 0) break;
+                left -= m;
+            }
+            if (left > 0) { close(logFd); logFd = -1; }
+            want = t;
+        }
+    }
+    ssize_t n;
+    while ((n = read(fd, buf, want)) < 0 && errno == EINTR) {}
+    if (n > 0) counters.captureBytes += (uint64_t)n;
+    return n;
+}
+
+// Background job output: drain the capture pipes and hand complete lines to
+// the event loop, a chunk at a time. The job itself is reaped by reapJobs()
+// on SIGCHLD, and reported once the last line has been handed over.
+static void streamJobOutput(int outFd, int errFd, int tabId, pid_t pgid)
+{
+    traceThreadName("job output");
+    auto post = [&](vector<string> &lines, bool isErr)
+    {
+        if (lines.empty()) return;
+        {
+            lock_guard<mutex> lk(mwQueueMutex);
+            for (auto &l : lines)
+                mwQueue.push({isErr ? "ERROR: " + l : std::move(l), tabId});
+        }
+        wakeUi();
+    };
+
+    string carry[2];
+    char *buffer = captureBuffer();
+    struct pollfd pfds[2];
+    pfds[0].fd = outFd; pfds[0].events = POLLIN | POLLHUP | POLLERR;
+    pfds[1].fd = errFd; pfds[1].events = POLLIN | POLLHUP | POLLERR;
+    int active = 2;
+    while (active > 0)
+    {
+        int r = poll(pfds, 2, -1);
+        if (r < 0) { if (errno == EINTR) continue; break; }
+        for (int i = 0; i < 2; ++i)
+        {
+            if (pfds[i].fd < 0 || !(pfds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            ssize_t n = read(pfds[i].fd, buffer, CAPTURE_CHUNK);
+            if (n <= 0) { close(pfds[i].fd); pfds[i].fd = -1; active--; continue; }
+            counters.captureBytes += (uint64_t)n;
+
+            vector<string> lines;
+            appendLines(lines, carry[i], buffer, n);
+            post(lines, i == 1);
+        }
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        if (pfds[i].fd >= 0) close(pfds[i].fd);
+        vector<string> rest;
+        if (!carry[i].empty()) rest.push_back(std::move(carry[i]));
+        post(rest, i == 1);
+    }
+    jobOutputDrained(tabId, pgid);
+    wakeUi();
+}
+
+// Foreground pipeline: collect its output and the exit status of every stage
+// (status gets the last one's), and turn them into the lines to show. Runs on
+// the UI thread, or on a worker for a command the tab does not wait for.
+static vector<string> collectPipeline(int outFd, int errFd, const vector<pid_t> &pids, const string &teeLogPath,
+                                      chrono::steady_clock::time_point started, const string &firstPart,
+                                      int &status)
+{
+    // Optional raw log of stdout: bytes are tee'd in-kernel and spliced to the file
+    int logFd = -1;
+    int teePipe[2] = {-1, -1};
+    if (!teeLogPath.empty())
+    {
+        logFd = open(teeLogPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        if (logFd >= 0 && (lseek(logFd, 0, SEEK_END) < 0 || pipe2(teePipe, O_CLOEXEC) < 0))
+        {
+            close(logFd);
+            logFd = -1;
+        }
+        if (logFd >= 0) growPipe(teePipe[1]);
+    }
 
-static vector<string> execInDir(const string &cmd, string &cwd_for_tab)
+    traceScope waitTrace("capture output");
+
+    // Pipes and child exits are watched in one poll set, so every status is
+    // collected as soon as it exists instead of by blocking waitpid afterwards.
+    int nPids = (int)pids.size();
+    vector<int> statuses(nPids, 0);
+    vector<bool> reaped(nPids, false);
+
+    // Output is split into lines straight out of the read buffer; the lines
+    // are then moved (not copied) into the tab's displayBuffer by the caller.
+    vector<string> outLines, errLines;
+    string outCarry, errCarry;
+    char *buffer = captureBuffer();
+    vector<struct pollfd> pfds(2 + nPids);
+    pfds[0].fd = outFd; pfds[0].events = POLLIN | POLLHUP | POLLERR;
+    pfds[1].fd = errFd; pfds[1].events = POLLIN | POLLHUP | POLLERR;
+    int watching = 0;
+    for (int k = 0; k < nPids; ++k)
+    {
+        pfds[2 + k].fd = openPidfd(pids[k]);
+        pfds[2 + k].events = POLLIN;
+        if (pfds[2 + k].fd >= 0) watching++;
+    }
+    int noLog = -1;
+    auto consume = [&](int i) -> bool
+    {
+        ssize_t n = readCapture(pfds[i].fd, buffer, i == 0 ? logFd : noLog, teePipe);
+        if (n <= 0) { close(pfds[i].fd); pfds[i].fd = -1; return false; }
+        if (i == 0) appendLines(outLines, outCarry, buffer, n);
+        else appendLines(errLines, errCarry, buffer, n);
+        return true;
+    };
+    int active = 2;
+    while (active > 0 || watching > 0)
+    {
+        int r = poll(pfds.data(), pfds.size(), -1);
+        if (r < 0) { if (errno == EINTR) continue; break; }
+        for (int k = 0; k < nPids; ++k)
+        {
+            struct pollfd &p = pfds[2 + k];
+            if (p.fd < 0 || !(p.revents & POLLIN)) continue;
+            if (waitpid(pids[k], &statuses[k], WNOHANG) == pids[k]) reaped[k] = true;
+            close(p.fd); p.fd = -1; watching--;
+        }
+        for (int i = 0; i < 2; ++i)
+        {
+            if (pfds[i].fd < 0) continue;
+            if (pfds[i].revents & POLLIN)
+            {
+                if (!consume(i)) active--;
+            }
+            else if (pfds[i].revents & (POLLHUP | POLLERR))
+            {
+                while (consume(i)) {}
+                active--;
+            }
+        }
+    }
+    if (!outCarry.empty()) outLines.push_back(std::move(outCarry));
+    if (!errCarry.empty()) errLines.push_back(std::move(errCarry));
+    waitTrace.end();
+
+    for (auto &p : pfds) if (p.fd >= 0) { close(p.fd); p.fd = -1; }
+    if (logFd >= 0) close(logFd);
+    if (teePipe[0] >= 0) { close(teePipe[0]); close(teePipe[1]); }
+
+    bool hadError = false;
+    int lastFlag = 0;
+    for (int k = 0; k < nPids; ++k)
+    {
+        // only reached without pidfd support (or if poll failed)
+        if (!reaped[k])
+        {
+            pid_t r;
+            while ((r = waitpid(pids[k], &statuses[k], 0)) < 0 && errno == EINTR) {}
+            if (r < 0) { hadError = true; continue; }
+        }
+        int st = statuses[k];
+        lastFlag = st;
+        // an upstream stage killed by SIGPIPE just means its reader quit early
+        if (k < nPids - 1 && WIFSIGNALED(st) && WTERMSIG(st) == SIGPIPE) continue;
+        if (!WIFEXITED(st) || WEXITSTATUS(st) != 0) hadError = true;
+    }
+
+    // exec latency, filed under the first stage's program
+    addTiming(execTimes, firstPart.substr(0, firstPart.find_first_of(" \t")), usSince(started));
+    status = lastFlag;
+
+    if (!errLines.empty()) hadError = true;
+
+    if (hadError)
+    {
+        vector<string> &src = !errLines.empty() ? errLines : outLines;
+        if (src.empty())
+        {
+            int exitCode = (WIFEXITED(lastFlag) ? WEXITSTATUS(lastFlag) : -1);
+            return {string("ERROR: (process exited with code ") + to_string(exitCode) + ")"};
+        }
+        for (auto &l : src) l.insert(0, "ERROR: ");
+        return std::move(src);
+    }
+
+    if (outLines.empty()) outLines.push_back("");
+    return outLines;
+}
+
+vector<string> execInDir(const string &cmd, tabState &T, bool wait)
 {
+    TRACE_SCOPE("execInDir", cmd.c_str());
     if (cmd.empty())
         return {""};
 
+    string &cwd_for_tab = T.cwd;
+    T.lastStatus = 0;
+
     auto trim = [](string s){
         s.erase(0, s.find_first_not_of(" \t"));
         if (!s.empty()) s.erase(s.find_last_not_of(" \t") + 1);
@@ -320,6 +518,48 @@ static vector<string> execInDir(const string &cmd, string &cwd_for_tab)
 
     string stripped = trim(cmd);
 
+    // Job control builtins (tab-local)
+    if (stripped == "jobs")
+        return jobsBuiltin(T.id);
+    if (stripped == "fg" || stripped.rfind("fg ", 0) == 0)
+    {
+        // the tab waits for the resumed job as for one it started
+        vector<string> out = fgBuiltin(T.id, trim(stripped.substr(2)), T.fg.pgid);
+        T.fg.resumed = true;
+        if (!T.fg.pgid) T.lastStatus = 1;
+        return out;
+    }
+    if (stripped == "bg" || stripped.rfind("bg ", 0) == 0)
+        return bgBuiltin(T.id, trim(stripped.substr(2)));
+
+    // teelog <file> | teelog off: copy raw stdout of this tab's commands to a file
+    if (stripped == "teelog" || stripped.rfind("teelog ", 0) == 0)
+    {
+        string arg = trim(stripped.substr(6));
+        if (arg.empty())
+            return {T.teeLogPath.empty() ? "teelog: off" : "teelog: " + T.teeLogPath};
+        if (arg == "off") { T.teeLogPath.clear(); return {""}; }
+        T.teeLogPath = (arg[0] == '/') ? arg : cwd_for_tab + "/" + arg;
+        return {""};
+    }
+
+    // trace on | off | dump [file]: event trace of the whole terminal (trace.cpp)
+    if (stripped == "trace" || stripped.rfind("trace ", 0) == 0)
+        return traceBuiltin(trim(stripped.substr(5)), cwd_for_tab);
+
+    // sessionlog on [dir] | sessionlog off: record commands and output of this tab
+    if (stripped == "sessionlog" || stripped.rfind("sessionlog ", 0) == 0)
+        return sessionLogBuiltin(T.id, trim(stripped.substr(10)), cwd_for_tab);
+
+    // Trailing '&' runs the pipeline as a background job of this tab
+    bool background = false;
+    if (!stripped.empty() && stripped.back() == '&' && (stripped.size() < 2 || stripped[stripped.size() - 2] != '&'))
+    {
+        background = true;
+        stripped = trim(stripped.substr(0, stripped.size() - 1));
+        if (stripped.empty()) return {""};
+    }
+
     // Built-in cd (tab-local)
     if (stripped.rfind("cd ", 0) == 0)
     {
@@ -344,6 +584,7 @@ static vector<string> execInDir(const string &cmd, string &cwd_for_tab)
                 return {""};
             }
         }
+        T.lastStatus = 1;
         return {string("ERROR: cd: no such file or directory: ") + path};
     }
     if (stripped == "cd" || stripped == "cd ~")
@@ -357,7 +598,7 @@ static vector<string> execInDir(const string &cmd, string &cwd_for_tab)
     // Split pipeline
     vector<string> getPipeParts;
     {
-        stringstream ss(cmd);
+        stringstream ss(stripped);
         string part;
         while (getline(ss, part, '|'))
         {
@@ -376,25 +617,37 @@ static vector<string> execInDir(const string &cmd, string &cwd_for_tab)
         if (pipe(chainFds.data() + i * 2) < 0)
         {
             for (int j = 0; j < i; ++j) { close(chainFds[j*2]); close(chainFds[j*2+1]); }
+            T.lastStatus = 1;
             return {"ERROR: pipe creation failed"};
         }
     }
 
     int capture_out[2] = {-1,-1}, capture_err[2] = {-1,-1};
+    T.lastStatus = 1;
     if (pipe(capture_out) < 0) { for (int fd : chainFds) if (fd>=0) close(fd); return {"ERROR: capture_out pipe failed"}; }
     if (pipe(capture_err) < 0) { close(capture_out[0]); close(capture_out[1]); for (int fd : chainFds) if (fd>=0) close(fd); return {"ERROR: capture_err pipe failed"}; }
+    T.lastStatus = 0;
+    growPipe(capture_out[1]);
 
     vector<pid_t> pids;
+    pid_t pgid = 0;
     bool forkError = false;
+    auto started = chrono::steady_clock::now();
+    traceScope forkTrace("fork pipeline");
 
     for (int i = 0; i < sizeOfParts; ++i)
     {
         pid_t pid = fork();
         if (pid < 0) { forkError = true; break; }
+        if (pid > 0) counters.forks++;
 
         if (pid == 0)
         {
-            // CHILD: set CWD to tab's cwd before exec
+            // CHILD: own process group per pipeline, so interrupts hit the whole job
+            setpgid(0, pgid);
+            resetChildSignals();
+
+            // set CWD to tab's cwd before exec
             if (!cwd_for_tab.empty())
                 chdir(cwd_for_tab.c_str());
 
@@ -413,6 +666,7 @@ static vector<string> execInDir(const string &cmd, string &cwd_for_tab)
         }
         else
         {
+            joinJobGroup(pid, pgid);
             pids.push_back(pid);
         }
     }
@@ -422,137 +676,81 @@ static vector<string> execInDir(const string &cmd, string &cwd_for_tab)
         for (int fd : chainFds) if (fd >= 0) close(fd);
         close(capture_out[0]); close(capture_out[1]);
         close(capture_err[0]); close(capture_err[1]);
+        if (pgid > 0) kill(-pgid, SIGKILL);
         for (pid_t p : pids) if (p>0) waitpid(p, nullptr, 0);
+        T.lastStatus = 1;
         return {"ERROR: fork failed"};
     }
 
     for (int fd : chainFds) if (fd >= 0) close(fd);
     close(capture_out[1]);
     close(capture_err[1]);
+    forkTrace.end();
 
-    // Record pids so UI-triggered interrupts can kill them.
-    {
-        lock_guard<mutex> lk(currPidsMutex);
-        currChildPids = pids;
-        cmdUnderExec.store(true);
-    }
+    // Record the job under this tab so Ctrl+C / jobs / fg / bg can find it.
+    // A foreground pipeline is reaped by collectPipeline, the rest by reapJobs.
+    int jobId = registerJob(T.id, pgid, pids, stripped, background, !background, background || !wait);
 
-    string opBuffer, errBuffer; const int BUFFER_SIZE = 4096; char buffer[BUFFER_SIZE];
-    struct pollfd pfds[2];
-    pfds[0].fd = capture_out[0]; pfds[0].events = POLLIN | POLLHUP | POLLERR;
-    pfds[1].fd = capture_err[0]; pfds[1].events = POLLIN | POLLHUP | POLLERR;
-    int active = 2;
-    while (active > 0)
+    if (background)
     {
-        // handle any pending UI-requested SIGINT
-        handleSigintLeft();
-
-        int r = poll(pfds, 2, -1);
-        if (r < 0) { if (errno == EINTR) { handleSigintLeft(); continue; } break; }
-        for (int i = 0; i < 2; ++i)
-        {
-            if (pfds[i].fd < 0) continue;
-            if (pfds[i].revents & POLLIN)
-            {
-                ssize_t n = read(pfds[i].fd, buffer, BUFFER_SIZE);
-                if (n > 0) { (i==0 ? opBuffer : errBuffer).append(buffer, n); }
-                else { close(pfds[i].fd); pfds[i].fd = -1; active--; }
-            }
-            else if (pfds[i].revents & (POLLHUP | POLLERR))
-            {
-                while (true)
-                {
-                    ssize_t n = read(pfds[i].fd, buffer, BUFFER_SIZE);
-                    if (n > 0) { (i==0 ? opBuffer : errBuffer).append(buffer, n); }
-                    else { close(pfds[i].fd); pfds[i].fd = -1; active--; break; }
-                }
-            }
-        }
+        thread(streamJobOutput, capture_out[0], capture_err[0], T.id, pgid).detach();
+        // the children may already be gone; make sure the loop looks
+        reapPending = true;
+        return {"[" + to_string(jobId) + "] " + to_string(pgid)};
     }
-    if (pfds[0].fd >= 0) { close(pfds[0].fd); pfds[0].fd = -1; }
-    if (pfds[1].fd >= 0) { close(pfds[1].fd); pfds[1].fd = -1; }
 
-    bool hadError = false;
-    int lastFlag = 0;
-    for (pid_t pid : pids)
+    if (!wait)
     {
-        int status = 0;
-        if (waitpid(pid, &status, 0) < 0) { hadError = true; }
-        else
-        {
-            lastFlag = status;
-            if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) hadError = true;
-        }
+        // the tab waits for it instead; the worker hands over the result
+        T.fg.pgid = pgid;
+        T.fg.resumed = false;
+        time_t startedAt = time(nullptr);
+        thread([=, teeLogPath = T.teeLogPath, tabId = T.id]()
+               {
+                   traceThreadName("foreground");
+                   commandResult res{tabId, pgid, {}, 0, ""};
+                   int status = 0;
+                   res.lines = collectPipeline(capture_out[0], capture_err[0], pids, teeLogPath, started,
+                                               getPipeParts[0], status);
+                   res.status = shellStatus(status);
+                   res.note = forgetJob(tabId, pgid, status);
+                   // the tab keeps the lines; the log gets its copy here, not on the UI thread
+                   if (sessionLogEnabled(tabId))
+                       sessionLogCommand(tabId, startedAt, cwd_for_tab, cmd, res.status,
+                                         (long long)(usSince(started) / 1000), res.lines);
+                   {
+                       lock_guard<mutex> lk(mwQueueMutex);
+                       commandResults.push_back(std::move(res));
+                   }
+                   wakeUi();
+               })
+            .detach();
+        return {};
     }
 
-    // clear current child list
-    {
-        lock_guard<mutex> lk(currPidsMutex);
-        currChildPids.clear();
-        cmdUnderExec.store(false);
-    }
-
-    if (!errBuffer.empty()) hadError = true;
-
-    auto splitLines = [](const string &s)->vector<string>{
-        vector<string> out; size_t pos=0;
-        while (true)
-        {
-            size_t nl = s.find('\n', pos);
-            if (nl == string::npos) break;
-            out.push_back(s.substr(pos, nl-pos));
-            pos = nl+1;
-        }
-        if (pos < s.size()) out.push_back(s.substr(pos));
-        return out;
-    };
-
-    vector<string> outLines = splitLines(opBuffer);
-    vector<string> errLines = splitLines(errBuffer);
-    vector<string> output;
-
-    if (hadError)
-    {
-        if (!errLines.empty()) { for (auto &l : errLines) output.push_back(string("ERROR: ") + l); }
-        else if (!outLines.empty()) { for (auto &l : outLines) output.push_back(string("ERROR: ") + l); }
-        else
-        {
-            int exitCode = (WIFEXITED(lastFlag) ? WEXITSTATUS(lastFlag) : -1);
-            output.push_back(string("ERROR: (process exited with code ") + to_string(exitCode) + ")");
-        }
-    }
-    else
-    {
-        output = std::move(outLines);
-        if (output.empty()) output.push_back("");
-    }
-
-    return output;
+    int status = 0;
+    vector<string> lines = collectPipeline(capture_out[0], capture_err[0], pids, T.teeLogPath, started,
+                                           getPipeParts[0], status);
+    forgetJob(T.id, pgid);
+    T.lastStatus = shellStatus(status);
+    return lines;
 }
 
-void sigintMultiWatch(int) { mwStopReq.store(true); }
-
-// multiWatch: line-by-line updates + runs in tab's cwd
-void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tab_index, const vector<string> &oldBuffer)
+void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tabId, const vector<string> &oldBuffer,
+                                    shared_ptr<tabWatch> w)
 
 {
     if (cmds.empty())
+    {
+        finishWatch(tabId, w);
         return;
-    if (tab_index < 0 || tab_index >= (int)tabs.size())
-        return;
-
-    tabState &T = tabs[tab_index];
-
-    // Save old screen buffer for restore
-
-    T.displayBuffer.clear();
-    T.displayBuffer.push_back("multiWatch — starting...");
-    mwStopReq.store(false);
-    mwDone.store(false);
-    cmdRunning.store(true);
+    }
+    traceThreadName("multiWatch");
 
-    while (!mwStopReq.load())
+    while (!w->stop.load())
     {
+        auto cycleStart = chrono::steady_clock::now();
+        traceScope cycleTrace("multiWatch cycle");
         vector<thread> workers;
         vector<pair<string, string>> results;
         mutex results_mtx;
@@ -561,13 +759,20 @@ void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tab_index, c
         {
             workers.emplace_back([&, cmd]()
                                  {
+                traceThreadName("multiWatch worker");
+                TRACE_SCOPE("multiWatch command", cmd.c_str());
                 int pipefd[2];
                 if (pipe(pipefd) < 0) return;
 
+                auto started = chrono::steady_clock::now();
                 pid_t pid = fork();
+                if (pid > 0)
+                    counters.forks++;
                 if (pid == 0)
                 {
-                    // Child: redirect stdout/stderr to pipe
+                    // Child: own process group, redirect stdout/stderr to pipe
+                    setpgid(0, 0);
+                    resetChildSignals();
                     close(pipefd[0]);
                     dup2(pipefd[1], STDOUT_FILENO);
                     dup2(pipefd[1], STDERR_FILENO);
@@ -580,21 +785,21 @@ void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tab_index, c
                     close(pipefd[1]);
                     fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
 
-                    // Register PID
-                    {
-                        lock_guard<mutex> lk(currPidsMutex);
-                        currChildPids.push_back(pid);
-                    }
+                    // Register under the watching tab, out of reach of Ctrl+Z
+                    // (a stopped command would hold up the cycle) and of fg/bg;
+                    // Ctrl+C ends the watch, which ends its commands
+                    pid_t pgid = 0;
+                    joinJobGroup(pid, pgid);
+                    registerJob(tabId, pgid, {pid}, cmd, true, true, false);
+                    int pidfd = openPidfd(pid);
 
                     string outBuf;
                     char buf[4096];
                     struct pollfd pfd{pipefd[0], POLLIN | POLLHUP | POLLERR, 0};
                     bool done = false;
 
-                    while (!done && !mwStopReq.load())
+                    while (!done && !w->stop.load())
                     {
-                        handleSigintLeft();
-
                         int r = poll(&pfd, 1, 200);
                         if (r > 0)
                         {
@@ -602,7 +807,10 @@ void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tab_index, c
                             {
                                 ssize_t n = read(pipefd[0], buf, sizeof(buf));
                                 if (n > 0)
+                                {
                                     outBuf.append(buf, n);
+                                    counters.captureBytes += (uint64_t)n;
+                                }
                                 else if (n == 0)
                                     done = true;
                             }
@@ -615,22 +823,20 @@ void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tab_index, c
 
                     // Stop or wait
                     int status = 0;
-                    if (mwStopReq.load())
+                    if (w->stop.load())
                     {
-                        kill(pid, SIGINT);
-                        std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                        kill(pid, SIGKILL);
+                        // SIGINT, then SIGKILL only if still alive 100 ms later
+                        kill(-pgid, SIGINT);
+                        if (!waitChildExit(pid, pidfd, 100))
+                            kill(-pgid, SIGKILL);
                     }
-                    waitpid(pid, &status, 0);
+                    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+                    addTiming(watchTimes, cmd, usSince(started));
+                    if (pidfd >= 0) close(pidfd);
                     close(pipefd[0]);
 
-                    // Remove PID record
-                    {
-                        lock_guard<mutex> lk(currPidsMutex);
-                        auto it = std::find(currChildPids.begin(), currChildPids.end(), pid);
-                        if (it != currChildPids.end())
-                            currChildPids.erase(it);
-                    }
+                    // Remove job record
+                    forgetJob(tabId, pgid);
 
                     // Save result
                     lock_guard<mutex> lk(results_mtx);
@@ -643,48 +849,37 @@ void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tab_index, c
                 t.join();
 
         // Update output like "watch"
+        vector<string> frame;
+        frame.push_back("multiWatch — " + getTimeNow() + " (Ctrl+C to stop)");
+        frame.push_back("====================================================");
+        for (auto &[cmd, out] : results)
         {
-            T.displayBuffer.clear();
-            T.displayBuffer.push_back("multiWatch — " + getTimeNow() + " (Ctrl+C to stop)");
-            T.displayBuffer.push_back("====================================================");
-
-            for (auto &[cmd, out] : results)
-            {
-                T.displayBuffer.push_back("\"" + cmd + "\" output:");
-                T.displayBuffer.push_back("----------------------------------------------------");
-                std::stringstream ss(out);
-                std::string line;
-                while (std::getline(ss, line))
-                    T.displayBuffer.push_back(line);
-                T.displayBuffer.push_back("----------------------------------------------------");
-            }
+            frame.push_back("\"" + cmd + "\" output:");
+            frame.push_back("----------------------------------------------------");
+            std::stringstream ss(out);
+            std::string line;
+            while (std::getline(ss, line))
+                frame.push_back(line);
+            frame.push_back("----------------------------------------------------");
         }
+        postFrame(tabId, std::move(frame));
+        wakeUi();
+        {
+            lock_guard<mutex> lk(statMutex);
+            watchCycles.add(usSince(cycleStart));
+        }
+        cycleTrace.end();
 
-        // Refresh every 2s (with frequent stop checks)
-        for (int i = 0; i < 20 && !mwStopReq.load(); ++i)
-            std::this_thread::sleep_for(std::chrono::milliseconds(100));
-    }
-
-    // Cleanup any leftover child processes
-    {
-        lock_guard<mutex> lk(currPidsMutex);
-        for (pid_t p : currChildPids)
-            if (p > 0)
-                kill(p, SIGINT);
-        currChildPids.clear();
+        // Refresh every mwRefresh; getSigint() cuts the wait short
+        {
+            unique_lock<mutex> lk(watchMutex);
+            w->cv.wait_for(lk, mwRefresh, [&]{ return w->stop.load(); });
+        }
     }
 
     // Restore previous screen
-    T.displayBuffer = oldBuffer;
-
-    std::string sdisp = editPWD(T.cwd);
-
-    T.input.clear();
-    T.currentCursorPosition = 0;
+    postFrame(tabId, oldBuffer);
+    wakeUi();
 
-    // Reset state flags so the next command works
-    cmdRunning.store(false);
-    mwDone.store(true);
-    mwStopReq.store(false);
-    sigintReqFlag = 0; //
+    finishWatch(tabId, w);
 }
\ No newline at end of file
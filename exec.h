@@ -0,0 +1,39 @@
+#pragma once
+#include "draw.h"
+#include "jobs.h"
+
+//  Running commands (exec.cpp)
+
+// lines destined for a tab, drained by the event loop
+struct watchMsg { string text; int tabId; };
+extern mutex mwQueueMutex;
+extern queue<watchMsg> mwQueue;
+
+// A foreground command the tab did not wait for, once it has ended: its lines,
+// $? and, if it had been moved to the background by then, its Done note.
+struct commandResult { int tabId; pid_t pgid; vector<string> lines; int status; string note; };
+extern vector<commandResult> commandResults; // guarded by mwQueueMutex
+
+// wakes the event loop's poll() when a worker thread has something for it
+extern int uiWakeFd;
+
+void wakeUi();
+
+// time between multiWatch refreshes (termbench sets it to 0)
+extern chrono::milliseconds mwRefresh;
+
+// Called by the UI (run.cpp) when user presses Ctrl+C in a tab. Only that
+// tab's foreground jobs and multiWatch are interrupted.
+extern "C" void getSigint(int tabId);
+
+vector<string> execCommand(const string &cmd);
+// tab-aware exec: runs cmd in T's cwd. With wait false a foreground pipeline
+// is only started: T.fg.pgid names it, nothing is returned, and the outcome
+// arrives in commandResults. fg sets T.fg.pgid to the job it resumes.
+vector<string> execInDir(const string &cmd, tabState &T, bool wait = true);
+
+// multiWatch: line-by-line updates + runs in tab's cwd
+// Frames go through postFrame(); the watcher never touches tabState.
+// w comes from startWatch(tabId) and is finished here.
+void multiWatchThreaded_using_pipes(const vector<string> &cmds, int tabId, const vector<string> &oldBuffer,
+                                    shared_ptr<tabWatch> w);
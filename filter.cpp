@@ -0,0 +1,189 @@
+#include "filter.h"
+
+//  Scrollback filter (live grep of a tab)
+//
+// A filter keeps a view: the indices of the displayBuffer lines matching a
+// pattern, in order. Lines appended after the last update are the only ones
+// tested, so a tab streaming log output stays cheap to filter. std::regex is
+// only consulted for lines that contain the longest literal every match must
+// contain (found with findBytes); patterns without regex syntax never touch
+// it at all.
+
+const char *findBytes(const char *hay, size_t n, const string &needle)
+{
+    size_t k = needle.size();
+    if (k == 0 || n < k)
+        return nullptr;
+    if (k == 1)
+        return (const char *)memchr(hay, needle[0], n);
+#ifdef __SSE2__
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[k - 1]);
+    size_t i = 0;
+    for (; i + k - 1 + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(hay + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(hay + i + k - 1));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask)
+        {
+            int bit = __builtin_ctz(mask);
+            if (memcmp(hay + i + bit + 1, needle.data() + 1, k - 2) == 0)
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+    if (i + k > n)
+        return nullptr;
+    return (const char *)memmem(hay + i, n - i, needle.data(), k);
+#else
+    return (const char *)memmem(hay, n, needle.data(), k);
+#endif
+}
+
+static bool isRegexMeta(char c)
+{
+    return strchr("\\^$.|?*+()[]{}", c) != nullptr;
+}
+
+// Longest run of plain characters that any match of an ECMAScript pattern
+// must contain, or "" if none can be proven (alternation, all optional...).
+static string requiredLiteral(const string &p)
+{
+    if (p.find('|') != string::npos)
+        return "";
+    string best, run;
+    auto endRun = [&]()
+    {
+        if (run.size() > best.size())
+            best = run;
+        run.clear();
+    };
+    for (size_t i = 0; i < p.size(); ++i)
+    {
+        char c = p[i];
+        if (c == '\\' && i + 1 < p.size())
+        {
+            char e = p[++i];
+            if (isalnum((unsigned char)e))
+            {
+                endRun(); // \d, \w, \b, \n... are classes or anchors, not literals
+                // and the operands of \xHH, \uHHHH, \cX and backreferences
+                // are part of the escape
+                if (e == 'x')
+                    i += 2;
+                else if (e == 'u')
+                    i += 4;
+                else if (e == 'c')
+                    i += 1;
+                else if (isdigit((unsigned char)e))
+                    while (i + 1 < p.size() && isdigit((unsigned char)p[i + 1]))
+                        ++i;
+                i = min(i, p.size() - 1);
+            }
+            else
+                run += e;
+        }
+        else if (c == '?' || c == '*')
+        {
+            // the previous atom may be absent
+            if (!run.empty())
+                run.pop_back();
+            endRun();
+        }
+        else if (c == '+')
+        {
+            endRun(); // previous char stays required but may repeat
+        }
+        else if (c == '{')
+        {
+            // {0,...} makes the previous atom optional, {n,...} repeats it
+            if (i + 1 < p.size() && p[i + 1] == '0' && !run.empty())
+                run.pop_back();
+            endRun();
+            size_t j = p.find('}', i);
+            i = (j == string::npos) ? p.size() : j;
+        }
+        else if (c == '[')
+        {
+            endRun();
+            size_t j = i + 1;
+            if (j < p.size() && p[j] == '^')
+                ++j;
+            if (j < p.size() && p[j] == ']')
+                ++j;
+            while (j < p.size() && p[j] != ']')
+                j += (p[j] == '\\') ? 2 : 1;
+            i = j;
+        }
+        else if (c == '(')
+        {
+            // a group may be optional or repeated; skip it whole
+            endRun();
+            int depth = 1;
+            size_t j = i + 1;
+            for (; j < p.size() && depth > 0; ++j)
+            {
+                if (p[j] == '\\')
+                    ++j;
+                else if (p[j] == '(')
+                    ++depth;
+                else if (p[j] == ')')
+                    --depth;
+            }
+            i = j - 1;
+        }
+        else if (isRegexMeta(c))
+            endRun();
+        else
+            run += c;
+    }
+    endRun();
+    return best;
+}
+
+void lineFilter::set(const string &p)
+{
+    pattern = p;
+    error.clear();
+    valid = false;
+    reset();
+    if (p.empty())
+        return;
+    literal = find_if(p.begin(), p.end(), isRegexMeta) == p.end();
+    required = literal ? p : requiredLiteral(p);
+    if (!literal)
+    {
+        try
+        {
+            re.assign(p, regex::ECMAScript | regex::optimize | regex::nosubs);
+        }
+        catch (const regex_error &)
+        {
+            error = "invalid pattern";
+            return;
+        }
+    }
+    valid = true;
+}
+
+bool lineFilter::matches(const string &line) const
+{
+    if (!required.empty() && !findBytes(line.data(), line.size(), required))
+        return false;
+    return literal || regex_search(line, re);
+}
+
+void lineFilter::update(const vector<string> &lines, uint64_t gen)
+{
+    if (!valid)
+        return;
+    if (gen != bufGen || scanned > lines.size())
+    {
+        bufGen = gen;
+        reset();
+    }
+    for (; scanned < lines.size(); ++scanned)
+        if (matches(lines[scanned]))
+            view.push_back(scanned);
+}
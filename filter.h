@@ -0,0 +1,39 @@
+#pragma once
+#include "headers.h"
+
+//  Scrollback filter (filter.cpp)
+
+// First occurrence of needle in [hay, hay + n), or nullptr. Tests 16
+// positions per step against the needle's first and last byte and compares
+// in full only where both match.
+const char *findBytes(const char *hay, size_t n, const string &needle);
+
+struct lineFilter
+{
+    string pattern;
+    string error;          // why pattern did not compile, "" if it did
+    bool valid = false;    // a pattern is set and compiled
+    bool literal = false;  // pattern has no regex syntax
+    string required;       // literal prefilter ("" if none)
+    regex re;
+    vector<size_t> view;   // displayBuffer indices of matching lines
+    size_t scanned = 0;    // lines tested so far
+    uint64_t bufGen = 0;   // tab bufGen the view belongs to
+    uint64_t viewGen = 0;  // bumped whenever view is rebuilt or switched
+
+    bool active() const { return valid; }
+
+    void reset()
+    {
+        view.clear();
+        scanned = 0;
+        ++viewGen;
+    }
+
+    void set(const string &p);
+    void clear() { set(""); }
+    bool matches(const string &line) const;
+    // Test lines appended since the last call; start over if the buffer
+    // was cleared or replaced.
+    void update(const vector<string> &lines, uint64_t gen);
+};
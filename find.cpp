@@ -0,0 +1,144 @@
+#include "find.h"
+#include "exec.h"
+#include "filter.h"
+#include "trace.h"
+
+//  Find in scrollback (Ctrl+Shift+F)
+//
+// Each displayBuffer line is scanned with findBytes (filter.cpp), an SSE2
+// first/last-byte filter that only compares candidate positions in full.
+// Small buffers are scanned inline. Big ones are scanned by a helper thread
+// that only runs while the event loop is idle: the loop holds findMutex for
+// everything it does between two poll() calls and the scanner takes it per
+// slice of lines, so displayBuffer is never read while it is being changed.
+
+mutex findMutex;
+atomic<bool> findUiWaiting(false);
+static uint64_t findScanId = 0; // scanners of older queries exit, guarded by findMutex
+bool findScanFinished = false;
+
+static const size_t FIND_INLINE_LINES = 50000;
+static const size_t FIND_SLICE_LINES = 8192;
+
+// Record the matches of T.findQuery in displayBuffer lines [from, to).
+static void scanFindLines(tabState &T, size_t from, size_t to)
+{
+    const string &q = T.findQuery;
+    for (size_t i = from; i < to; ++i)
+    {
+        const string &line = T.displayBuffer[i];
+        const char *p = line.data();
+        const char *end = p + line.size();
+        while (const char *hit = findBytes(p, (size_t)(end - p), q))
+        {
+            T.findHits.push_back({i, (size_t)(hit - line.data())});
+            p = hit + q.size();
+        }
+    }
+    T.findScanned = to;
+}
+
+static void findScanLoop(uint64_t scanId, int tabId)
+{
+    traceThreadName("find scan");
+    while (true)
+    {
+        // let a waiting event loop in between slices
+        while (findUiWaiting.load())
+            this_thread::yield();
+
+        lock_guard<mutex> lk(findMutex);
+        TRACE_SCOPE("find slice");
+        tabState *tab = tabById(tabId);
+        if (scanId != findScanId || !tab)
+            return;
+        tabState &T = *tab;
+        size_t to = min(T.displayBuffer.size(), T.findScanned + FIND_SLICE_LINES);
+        scanFindLines(T, T.findScanned, to);
+        if (T.findScanned >= T.displayBuffer.size())
+        {
+            T.findScanning = false;
+            findScanFinished = true;
+            wakeUi();
+            return;
+        }
+    }
+}
+
+// Scan lines from T.findScanned on, inline or in the background.
+// Caller holds findMutex.
+static void continueFind(tabState &T)
+{
+    if (T.displayBuffer.size() - T.findScanned <= FIND_INLINE_LINES)
+    {
+        scanFindLines(T, T.findScanned, T.displayBuffer.size());
+        return;
+    }
+    T.findScanning = true;
+    thread(findScanLoop, findScanId, T.id).detach();
+}
+
+void startFind(tabState &T)
+{
+    ++findScanId;
+    T.findHits.clear();
+    T.findScanned = 0;
+    T.findCurrent = -1;
+    T.findScanning = false;
+    T.findGen = T.bufGen;
+    if (T.findQuery.empty())
+        return;
+    continueFind(T);
+    if (!T.findScanning && !T.findHits.empty())
+        T.findCurrent = (int)T.findHits.size() - 1;
+}
+
+void endFind(tabState &T)
+{
+    ++findScanId;
+    T.findFlag = false;
+    T.findScanning = false;
+    T.findQuery.clear();
+    T.findHits.clear();
+    T.findCurrent = -1;
+}
+
+bool findCatchUp(tabState &T)
+{
+    if (!T.findFlag || T.findScanning || T.findQuery.empty())
+        return false;
+    if (T.findGen != T.bufGen || T.findScanned > T.displayBuffer.size())
+    {
+        startFind(T);
+        return true;
+    }
+    if (T.findScanned == T.displayBuffer.size())
+        return false;
+    continueFind(T);
+    return true;
+}
+
+void showFindHit(renderer &R, tabState &T)
+{
+    makeScreen(R, T); // brings the wrap cache up to date
+    if (T.findCurrent < 0 || T.findCurrent >= (int)T.findHits.size())
+        return;
+    auto [line, offset] = T.findHits[T.findCurrent];
+    auto it = upper_bound(T.wrapRows.begin(), T.wrapRows.end(), make_pair(line, offset),
+                          [](const pair<size_t, size_t> &h, const wrapRow &r)
+                          { return h.first < r.line || (h.first == r.line && h.second < r.start); });
+    int row = (int)(it - T.wrapRows.begin()) - 1;
+    int seeRows = max(1, (winGeom.height - (NAVBAR_H + 30)) / R.lineH());
+    T.scrlOffset = max(0, row - seeRows / 2);
+    T.userScrolled = true;
+    makeScreen(R, T);
+}
+
+void stepFind(renderer &R, tabState &T, int dir)
+{
+    int n = (int)T.findHits.size();
+    if (n == 0)
+        return;
+    T.findCurrent = (T.findCurrent < 0) ? n - 1 : ((T.findCurrent + dir) % n + n) % n;
+    showFindHit(R, T);
+}
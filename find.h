@@ -0,0 +1,25 @@
+#pragma once
+#include "draw.h"
+
+//  Find in scrollback (find.cpp)
+
+// The event loop holds findMutex between two poll() calls; the scanner
+// thread takes it per slice of lines.
+extern mutex findMutex;
+extern atomic<bool> findUiWaiting; // event loop wants findMutex back
+extern bool findScanFinished;      // a background scan completed, guarded by findMutex
+
+// (Re)start the search for T.findQuery. Caller holds findMutex.
+void startFind(tabState &T);
+
+void endFind(tabState &T);
+
+// Keep the hits in step with the buffer: scan appended lines, start over if
+// it was cleared or replaced. Returns true if the hits may have changed.
+bool findCatchUp(tabState &T);
+
+// Scroll so the selected hit is in the middle of the screen.
+void showFindHit(renderer &R, tabState &T);
+
+// Step to the previous (older, dir < 0) or next match, wrapping around.
+void stepFind(renderer &R, tabState &T, int dir);
@@ -1,3 +1,5 @@
+#pragma once
+
 #include <iostream>
 #include <sstream>
 #include <fstream>
@@ -9,6 +11,8 @@
 #include <X11/Xlib.h>
 #include <X11/keysym.h>
 #include <X11/Xutil.h>
+#include <X11/Xatom.h>
+#include <X11/Xft/Xft.h>
 #include <cstdio>
 #include <err.h>
 #include <string>
@@ -27,6 +31,17 @@
 #include <queue>
 #include <iomanip>
 #include <atomic>
+#include <condition_variable>
+#include <sys/syscall.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/inotify.h>
+#include <dlfcn.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 
 using namespace std;
\ No newline at end of file
@@ -0,0 +1,259 @@
+#include "core.h"
+#include "exec.h"
+#include "find.h"
+#include "history.h"
+#include "jobs.h"
+#include "record.h"
+#include "replay.h"
+#include "termstat.h"
+
+using namespace std;
+
+//  Headless terminal
+//
+// The terminal core driven by a script instead of an X server, drawing into
+// an fbRenderer. Keysyms still come from the X headers (XStringToKeysym
+// needs no display), so only the libraries are linked. History is kept in
+// memory and never written to the history file.
+//
+//   headless [-s WxH] [-b FRAMES] [SCRIPT]
+//   headless [-s WxH] [-b FRAMES] -r SESSION [SCRIPT]
+//
+// The script (stdin if no file is given) has one command per line:
+//   type TEXT         type the text
+//   key SPEC          one key press, e.g. Return, Ctrl+c, Ctrl+Shift+f, Page_Up
+//   line TEXT         type the text, press Return and wait for the command
+//                     to finish or stop (key Return does not wait)
+//   wait MS           let background jobs and workers run for MS milliseconds
+//   screen            print the screen as text
+// Blank lines and lines starting with # are skipped. With -r a recorded
+// session (SHRETERM_RECORD, record.cpp) is replayed first, and the time taken
+// by each kind of event printed; then the script runs if one is given. With -b, renderbench is
+// run on the active tab afterwards and its report printed.
+
+static void headlessRepaint(fbRenderer &R)
+{
+    makeNavBar(R, winGeom.width);
+    makeTabs(R);
+    if (tabActive >= 0 && tabActive < (int)tabs.size())
+        makeScreen(R, tabs[tabActive]);
+}
+
+// Each key is a termstat latency sample of its own (there is nothing to flush).
+static void headlessKey(fbRenderer &R, const keyInput &k)
+{
+    if (recording())
+        recordEvent('K', {(long long)k.keysym, k.state, k.first}, {k.typed});
+    latencyInput();
+    if (!handleKey(R, k))
+        exit(0); // the last tab was closed
+    latencyFlushed();
+}
+
+static void headlessType(fbRenderer &R, const string &text)
+{
+    for (size_t i = 0; i < text.size();)
+    {
+        size_t used;
+        uint32_t cp = decodeUtf8(text.data() + i, text.size() - i, used);
+        keyInput k;
+        k.keysym = (cp < 0x100) ? cp : 0x01000000 | cp; // Latin-1 keysyms are the codepoint
+        k.chars = true;
+        k.first = (wchar_t)cp;
+        k.typed.assign(text, i, used);
+        headlessKey(R, k);
+        i += used;
+    }
+}
+
+// "Ctrl+Shift+f" -> keysym and modifiers, with the characters XIM would give.
+static bool parseKey(const string &spec, keyInput &k)
+{
+    string name = spec;
+    size_t plus;
+    while ((plus = name.find('+')) != string::npos && plus + 1 < name.size())
+    {
+        string mod = name.substr(0, plus);
+        if (mod == "Ctrl")
+            k.state |= ControlMask;
+        else if (mod == "Shift")
+            k.state |= ShiftMask;
+        else if (mod == "Alt")
+            k.state |= Mod1Mask;
+        else
+            return false;
+        name = name.substr(plus + 1);
+    }
+    k.keysym = XStringToKeysym(name.c_str());
+    if (k.keysym == NoSymbol)
+        return false;
+
+    switch (k.keysym)
+    {
+    case XK_Return: k.first = L'\r'; break;
+    case XK_BackSpace: k.first = 8; break;
+    case XK_Tab: k.first = L'\t'; break;
+    case XK_Escape: k.first = 27; break;
+    default:
+        if (k.keysym >= 0x20 && k.keysym < 0x7F)
+        {
+            char c = (char)k.keysym;
+            if (k.state & ControlMask)
+                k.first = c & 0x1F;
+            else
+            {
+                if ((k.state & ShiftMask) && isalpha((unsigned char)c))
+                {
+                    c = (char)toupper((unsigned char)c);
+                    k.keysym = (KeySym)c;
+                }
+                k.first = c;
+                k.typed = string(1, c);
+            }
+        }
+    }
+    k.chars = k.first != 0;
+    return true;
+}
+
+// Run background work for ms milliseconds, as the event loop would while idle.
+static void headlessWait(fbRenderer &R, unique_lock<mutex> &findLock, int ms)
+{
+    auto until = chrono::steady_clock::now() + chrono::milliseconds(ms);
+    while (true)
+    {
+        serviceTabs(R, true);
+        auto left = chrono::duration_cast<chrono::milliseconds>(until - chrono::steady_clock::now()).count();
+        if (left <= 0)
+            break;
+        int timeout = (int)left;
+        if (jobStateChangeExpected())
+            timeout = min(timeout, 20);
+
+        vector<struct pollfd> waitFds;
+        waitFds.push_back({uiWakeFd, POLLIN, 0});
+        size_t childFrom = waitFds.size();
+        addChildWatchFds(waitFds);
+
+        findLock.unlock();
+        int ready = poll(waitFds.data(), waitFds.size(), timeout);
+        findUiWaiting.store(true);
+        findLock.lock();
+        findUiWaiting.store(false);
+        if (ready > 0)
+        {
+            if (waitFds[0].revents & POLLIN)
+            {
+                uint64_t n;
+                if (read(uiWakeFd, &n, sizeof(n)) < 0) {}
+            }
+            if (childWatchFired(waitFds, childFrom))
+                reapPending = true;
+        }
+    }
+}
+
+static void printScreen(fbRenderer &R)
+{
+    headlessRepaint(R);
+    int last = R.rows - 1;
+    while (last >= 0 && R.rowText(last).empty())
+        --last;
+    for (int r = 0; r <= last; ++r)
+        cout << R.rowText(r) << "\n";
+    cout << "--" << endl;
+}
+
+int main(int argc, char **argv)
+{
+    int width = WIDTH, height = HEIGHT;
+    int benchFrames = 0;
+    const char *session = nullptr;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:b:r:")) != -1)
+    {
+        if (opt == 's' && sscanf(optarg, "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+            continue;
+        if (opt == 'b' && (benchFrames = atoi(optarg)) > 0)
+            continue;
+        if (opt == 'r')
+        {
+            session = optarg;
+            continue;
+        }
+        errx(1, "usage: %s [-s WxH] [-b FRAMES] [-r SESSION] [SCRIPT]", argv[0]);
+    }
+    ifstream file;
+    if (optind < argc)
+    {
+        file.open(argv[optind]);
+        if (!file)
+            err(1, "%s", argv[optind]);
+    }
+    istream &script = (optind < argc) ? file : cin;
+
+    winGeom.width = width;
+    winGeom.height = height;
+    fbRenderer R(width, height);
+
+    initChildWatch();
+    addTab("/");
+
+    // as in run(): held except while waiting, for the find scanner
+    unique_lock<mutex> findLock(findMutex);
+    headlessRepaint(R);
+
+    // SHRETERM_RECORD works here too, to record a scripted session
+    const char *recordPath = getenv("SHRETERM_RECORD");
+    if (recordPath && !session)
+    {
+        if (!recordBegin(recordPath, inputs))
+            err(1, "%s", recordPath);
+        recordEvent('S', {width, height});
+    }
+    if (session && !replaySession(R, session, [&](int w, int h) { R.resize(w, h); }, [] {}, cout))
+        return 1;
+
+    string line;
+    while ((!session || optind < argc) && getline(script, line))
+    {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        size_t sp = line.find(' ');
+        string cmd = line.substr(0, sp);
+        string arg = (sp == string::npos) ? "" : line.substr(sp + 1);
+
+        if (cmd == "type")
+            headlessType(R, arg);
+        else if (cmd == "line")
+        {
+            headlessType(R, arg);
+            keyInput k;
+            parseKey("Return", k);
+            int tabId = activeTab() ? activeTab()->id : 0;
+            headlessKey(R, k);
+            for (tabState *T; (T = tabById(tabId)) && T->fg.pgid;)
+                headlessWait(R, findLock, 10);
+        }
+        else if (cmd == "key")
+        {
+            keyInput k;
+            if (!parseKey(arg, k))
+                errx(1, "unknown key: %s", arg.c_str());
+            headlessKey(R, k);
+        }
+        else if (cmd == "wait")
+            headlessWait(R, findLock, atoi(arg.c_str()));
+        else if (cmd == "screen")
+            printScreen(R);
+        else
+            errx(1, "unknown command: %s", cmd.c_str());
+    }
+
+    if (benchFrames > 0 && tabActive >= 0 && tabActive < (int)tabs.size())
+        for (auto &l : renderBench(R, tabs[tabActive], to_string(benchFrames)))
+            cout << l << "\n";
+    return 0;
+}
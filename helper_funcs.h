@@ -0,0 +1,14 @@
+#pragma once
+#include "headers.h"
+
+//  Small helpers shared by the prompt, completion and history search
+
+extern int len; // length of the path prefix hidden from the prompt
+
+string getPWD();
+string editPWD(const string &cwd);
+string getTimeNow();
+int getMatchingPrefixLength(const string &a, const string &b);
+string extractQuery(string input);
+int getRecIdx(string inp);
+vector<string> getRecommendations(string query, vector<string> list);
@@ -0,0 +1,571 @@
+#include "history.h"
+#include "helper_funcs.h"
+#include "counters.h"
+#include "trace.h"
+
+//  Command history
+//
+// Append-only binary log. After a 16 byte file header every record is
+//
+//   u32 length   payload size in bytes
+//   u32 crc32    of the payload
+//   payload:     u64 index, i64 timestamp, i32 exit code, u32 duration (ms),
+//                u16 cwd length, u32 cmd length, cwd bytes, cmd bytes
+//
+// A record is written with a single write() on an O_APPEND descriptor, so a
+// crash can only leave a torn record at the tail; the loader stops at the
+// first record whose length or checksum does not add up and trims it off.
+//
+// Several terminal instances share the file. Appends take flock(LOCK_EX) just
+// long enough to pick up what others wrote since our last read (that fixes
+// the next index) and write one record. An inotify watch on the file tells
+// each instance when to read the new tail, and one on the directory when the
+// file was replaced; nothing is ever reread from the start unless another
+// instance compacted (replaced) the file.
+
+string historyPath = "./shreterm_history.bin";
+string legacyHistoryPath = "./input_log.txt";
+
+static const char HIST_MAGIC[4] = {'S', 'H', 'R', 'H'};
+static const uint32_t HIST_VERSION = 1;
+static const size_t HIST_HEADER_SIZE = 16;
+static const size_t HIST_FIXED_SIZE = 8 + 8 + 4 + 4 + 2 + 4;
+static const uint32_t HIST_MAX_RECORD = 1 << 20;
+// compaction keeps this many entries
+static const size_t HIST_KEEP = 100000;
+// fsync after this many appends or this long after the first unsynced one
+static const int HIST_SYNC_EVERY = 32;
+static const auto HIST_SYNC_DELAY = chrono::seconds(1);
+
+vector<string> inputs;
+vector<historyMeta> histMeta;
+
+int histFd = -1;
+static size_t histOffset = 0;    // records before this file offset are in memory
+int histWatchFd = -1;
+static int histWatchFile = -1;   // watch on the file itself (IN_MODIFY)
+static int histWatchDir = -1;    // watch on the directory (file created or renamed in)
+static string histWatchName;     // the file's name in that directory
+uint64_t histReloads = 0;
+
+// histFd is only swapped (compaction) with histSyncMutex held, and the sync
+// thread only touches it with the mutex held, so fsync never sees a stale fd.
+static mutex histSyncMutex;
+static condition_variable histSyncCv;
+static atomic<int> histUnsynced(0);
+static bool histSyncStop = false; // guarded by histSyncMutex
+static thread histSyncThread;
+
+uint32_t crc32Of(const char *data, size_t n)
+{
+    static uint32_t table[256];
+    static bool init = false;
+    if (!init)
+    {
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k)
+                c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+        init = true;
+    }
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < n; ++i)
+        crc = table[(crc ^ (unsigned char)data[i]) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+string encodeHistoryRecord(const historyMeta &m, const string &cwd, const string &cmd)
+{
+    string payload;
+    payload.reserve(HIST_FIXED_SIZE + cwd.size() + cmd.size());
+    putRaw<uint64_t>(payload, m.index);
+    putRaw<int64_t>(payload, m.time);
+    putRaw<int32_t>(payload, m.exitCode);
+    putRaw<uint32_t>(payload, m.durationMs);
+    putRaw<uint16_t>(payload, (uint16_t)min<size_t>(cwd.size(), 0xFFFF));
+    putRaw<uint32_t>(payload, (uint32_t)cmd.size());
+    payload.append(cwd, 0, min<size_t>(cwd.size(), 0xFFFF));
+    payload += cmd;
+
+    string rec;
+    rec.reserve(8 + payload.size());
+    putRaw<uint32_t>(rec, (uint32_t)payload.size());
+    putRaw<uint32_t>(rec, crc32Of(payload.data(), payload.size()));
+    rec += payload;
+    return rec;
+}
+
+string historyFileHeader()
+{
+    string h(HIST_MAGIC, 4);
+    putRaw<uint32_t>(h, HIST_VERSION);
+    putRaw<uint64_t>(h, 0);
+    return h;
+}
+
+// Parse records in [data+from, data+size). Calls fn(meta, cwd, cmd) for each
+// good record and returns the offset just past the last one.
+template <typename F>
+static size_t parseHistoryRecords(const char *data, size_t size, size_t from, F fn)
+{
+    size_t off = from;
+    while (off + 8 <= size)
+    {
+        uint32_t len = getRaw<uint32_t>(data + off);
+        uint32_t crc = getRaw<uint32_t>(data + off + 4);
+        if (len < HIST_FIXED_SIZE || len > HIST_MAX_RECORD || off + 8 + len > size)
+            break;
+        const char *p = data + off + 8;
+        if (crc32Of(p, len) != crc)
+            break;
+
+        historyMeta m;
+        m.index = getRaw<uint64_t>(p);
+        m.time = getRaw<int64_t>(p + 8);
+        m.exitCode = getRaw<int32_t>(p + 16);
+        m.durationMs = getRaw<uint32_t>(p + 20);
+        uint16_t cwdLen = getRaw<uint16_t>(p + 24);
+        uint32_t cmdLen = getRaw<uint32_t>(p + 26);
+        if (HIST_FIXED_SIZE + cwdLen + (size_t)cmdLen != len)
+            break;
+        fn(m, string_view(p + HIST_FIXED_SIZE, cwdLen), string_view(p + HIST_FIXED_SIZE + cwdLen, cmdLen));
+        off += 8 + len;
+    }
+    return off;
+}
+
+static bool writeAll(int fd, const string &buf)
+{
+    const char *p = buf.data();
+    size_t left = buf.size();
+    while (left > 0)
+    {
+        ssize_t n = write(fd, p, left);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+bool replaceFileAtomically(const string &path, const string &contents)
+{
+    string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return false;
+    bool ok = writeAll(fd, contents) && fsync(fd) == 0;
+    close(fd);
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        unlink(tmp.c_str());
+        return false;
+    }
+    string dir = path.substr(0, path.find_last_of('/') == string::npos ? 0 : path.find_last_of('/'));
+    int dfd = open(dir.empty() ? "." : dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dfd >= 0) { fsync(dfd); close(dfd); }
+    return true;
+}
+
+// One-time import of the old "  <n>  <cmd>" text log. Only the index and the
+// two separator spaces are stripped, so commands starting with digits survive.
+static void importLegacyHistory()
+{
+    ifstream in(legacyHistoryPath);
+    if (!in) return;
+
+    string out = historyFileHeader();
+    string line;
+    uint64_t idx = 0;
+    while (getline(in, line))
+    {
+        size_t p = line.find_first_not_of(' ');
+        if (p == string::npos) continue;
+        size_t q = line.find_first_not_of("0123456789", p);
+        string cmd;
+        if (q != p && q != string::npos && line.compare(q, 2, "  ") == 0) cmd = line.substr(q + 2);
+        else if (q == string::npos) continue; // bare index, empty command
+        else cmd = line.substr(p);
+        if (cmd.empty()) continue;
+
+        historyMeta m;
+        m.index = ++idx;
+        out += encodeHistoryRecord(m, "", cmd);
+    }
+    replaceFileAtomically(historyPath, out);
+}
+
+static void historySyncLoop()
+{
+    traceThreadName("history sync");
+    unique_lock<mutex> lk(histSyncMutex);
+    while (true)
+    {
+        // appenders notify without the lock; the timeout covers a missed wakeup
+        histSyncCv.wait_for(lk, HIST_SYNC_DELAY, []{ return histSyncStop || histUnsynced.load() > 0; });
+        if (!histSyncStop && histUnsynced.load() > 0 && histUnsynced.load() < HIST_SYNC_EVERY)
+            histSyncCv.wait_for(lk, HIST_SYNC_DELAY, []{ return histSyncStop || histUnsynced.load() >= HIST_SYNC_EVERY; });
+        if (histUnsynced.exchange(0) > 0 && histFd >= 0)
+        {
+            TRACE_SCOPE("fdatasync history");
+            fdatasync(histFd);
+        }
+        if (histSyncStop) break;
+    }
+}
+
+static void historyShutdown()
+{
+    {
+        lock_guard<mutex> lk(histSyncMutex);
+        histSyncStop = true;
+    }
+    histSyncCv.notify_all();
+    if (histSyncThread.joinable())
+        histSyncThread.join();
+}
+
+static void setHistoryFd(int fd)
+{
+    lock_guard<mutex> lk(histSyncMutex);
+    if (histFd >= 0) close(histFd);
+    histFd = fd;
+}
+
+void resetHistoryMemory()
+{
+    inputs.clear();
+    histMeta.clear();
+    histOffset = 0;
+    histReloads++;
+}
+
+// Lock the current history file (LOCK_EX / LOCK_SH). If another instance has
+// replaced it in the meantime, switch to the new file and start over.
+static bool lockHistory(int op)
+{
+    for (int tries = 0; tries < 8 && histFd >= 0; ++tries)
+    {
+        while (flock(histFd, op) != 0)
+            if (errno != EINTR) return false;
+
+        struct stat fs{}, ps{};
+        if (fstat(histFd, &fs) == 0 && stat(historyPath.c_str(), &ps) == 0 &&
+            fs.st_ino == ps.st_ino && fs.st_dev == ps.st_dev)
+            return true;
+
+        flock(histFd, LOCK_UN);
+        int fd = open(historyPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        setHistoryFd(fd);
+        resetHistoryMemory();
+    }
+    return false;
+}
+
+// Pull in records appended after histOffset, by us or by other instances.
+// Caller holds a lock; with repair (exclusive lock) a torn tail is trimmed.
+static bool readNewHistory(bool repair)
+{
+    TRACE_SCOPE("readNewHistory");
+    struct stat st{};
+    if (fstat(histFd, &st) != 0) return false;
+    size_t size = (size_t)st.st_size;
+
+    if (size < HIST_HEADER_SIZE)
+    {
+        // new (or unusable) file: start it over
+        if (repair && ftruncate(histFd, 0) == 0 && writeAll(histFd, historyFileHeader()))
+            histOffset = HIST_HEADER_SIZE;
+        return true;
+    }
+    if (size <= histOffset) return true;
+
+    // mapping is lazy: only the pages past histOffset are actually read
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, histFd, 0);
+    if (map == MAP_FAILED) return false;
+    const char *data = (const char *)map;
+    if (histOffset == 0)
+    {
+        if (memcmp(data, HIST_MAGIC, 4) != 0 || getRaw<uint32_t>(data + 4) != HIST_VERSION)
+        {
+            munmap(map, size);
+            cerr << "history: unrecognised format in " << historyPath << "\n";
+            return false;
+        }
+        histOffset = HIST_HEADER_SIZE;
+    }
+    histOffset = parseHistoryRecords(data, size, histOffset,
+        [&](const historyMeta &m, string_view, string_view cmd)
+        {
+            inputs.emplace_back(cmd);
+            histMeta.push_back(m);
+        });
+    munmap(map, size);
+
+    // drop a torn tail left by a crash mid-append
+    if (repair && histOffset < size && ftruncate(histFd, histOffset) != 0)
+        cerr << "history: cannot trim damaged tail of " << historyPath << "\n";
+    return true;
+}
+
+// Appends show up as IN_MODIFY on the file. The directory is only watched
+// for the file being created or renamed over (compaction), since it also
+// holds files that change all the time (the session snapshot, for one).
+static void watchHistoryFile()
+{
+    if (histWatchFd >= 0) return;
+    histWatchFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (histWatchFd < 0) return;
+    size_t slash = historyPath.find_last_of('/');
+    string dir = (slash == string::npos) ? "." : historyPath.substr(0, max<size_t>(slash, 1));
+    histWatchName = (slash == string::npos) ? historyPath : historyPath.substr(slash + 1);
+    histWatchDir = inotify_add_watch(histWatchFd, dir.c_str(), IN_MOVED_TO | IN_CREATE);
+    if (histWatchDir < 0)
+    {
+        close(histWatchFd);
+        histWatchFd = -1;
+        return;
+    }
+    histWatchFile = inotify_add_watch(histWatchFd, historyPath.c_str(), IN_MODIFY);
+}
+
+void loadHistory()
+{
+    TRACE_SCOPE("loadHistory");
+    auto t0 = chrono::steady_clock::now();
+    struct stat st{};
+    if (stat(historyPath.c_str(), &st) != 0)
+        importLegacyHistory();
+
+    int fd = open(historyPath.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    setHistoryFd(fd);
+    resetHistoryMemory();
+    if (lockHistory(LOCK_EX))
+    {
+        if (!readNewHistory(true))
+            setHistoryFd(-1);
+        else
+            flock(histFd, LOCK_UN);
+    }
+
+    counters.historyLoadUs = usSince(t0);
+
+    watchHistoryFile();
+    if (!histSyncThread.joinable())
+    {
+        histSyncThread = thread(historySyncLoop);
+        atexit(historyShutdown);
+    }
+}
+
+static thread histLoadThread;
+atomic<bool> histLoadDone(false);
+
+bool historyLoading() { return histLoadThread.joinable(); }
+
+bool awaitHistoryLoad()
+{
+    if (!histLoadThread.joinable())
+        return false;
+    histLoadThread.join();
+    return true;
+}
+
+void loadHistoryAsync(function<void()> done)
+{
+    histLoadThread = thread([done] {
+        traceThreadName("history load");
+        loadHistory();
+        histLoadDone.store(true);
+        done();
+    });
+    // joined before the thread object is destroyed, however we exit
+    atexit([] { awaitHistoryLoad(); });
+}
+
+bool historyChanged()
+{
+    TRACE_SCOPE("historyChanged");
+    if (histWatchFd < 0) return false;
+
+    bool relevant = false, replaced = false;
+    alignas(struct inotify_event) char buf[4096];
+    ssize_t n;
+    while ((n = read(histWatchFd, buf, sizeof(buf))) > 0)
+    {
+        for (char *p = buf; p < buf + n;)
+        {
+            auto *ev = (struct inotify_event *)p;
+            p += sizeof(struct inotify_event) + ev->len;
+            if (ev->wd == histWatchFile && (ev->mask & IN_MODIFY))
+                relevant = true;
+            else if (ev->wd == histWatchDir && ev->len > 0 && histWatchName == ev->name)
+                relevant = replaced = true;
+        }
+    }
+    // a new file at the path: watch it instead (the old watch went with the old inode)
+    if (replaced)
+        histWatchFile = inotify_add_watch(histWatchFd, historyPath.c_str(), IN_MODIFY);
+    if (!relevant || histFd < 0) return false;
+
+    size_t before = inputs.size();
+    uint64_t reloads = histReloads;
+    if (lockHistory(LOCK_SH))
+    {
+        readNewHistory(false);
+        flock(histFd, LOCK_UN);
+    }
+    return inputs.size() != before || reloads != histReloads;
+}
+
+void storeHistory(const string &input, const string &cwd, int exitCode, long long durationMs)
+{
+    TRACE_SCOPE("storeHistory");
+    // catch up first so the index follows whatever other instances wrote
+    bool locked = lockHistory(LOCK_EX);
+    if (locked)
+        readNewHistory(true);
+
+    historyMeta m;
+    m.index = histMeta.empty() ? 1 : histMeta.back().index + 1;
+    m.time = (int64_t)time(nullptr);
+    m.exitCode = exitCode;
+    m.durationMs = (uint32_t)max(0LL, durationMs);
+    inputs.push_back(input);
+    histMeta.push_back(m);
+
+    if (!locked)
+        return;
+    string rec = encodeHistoryRecord(m, cwd, input);
+    if (writeAll(histFd, rec))
+        histOffset += rec.size();
+    else
+        cerr << "Error writing history.\n";
+    flock(histFd, LOCK_UN);
+
+    if (++histUnsynced >= HIST_SYNC_EVERY)
+        histSyncCv.notify_all();
+}
+
+vector<string> compactHistory()
+{
+    TRACE_SCOPE("compactHistory");
+    struct stat st{};
+    if (histFd < 0 || !lockHistory(LOCK_EX))
+        return {"ERROR: history: no history file"};
+    if (fstat(histFd, &st) != 0)
+    {
+        flock(histFd, LOCK_UN);
+        return {"ERROR: history: no history file"};
+    }
+
+    size_t size = (size_t)st.st_size;
+    void *map = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, histFd, 0) : MAP_FAILED;
+    if (map == MAP_FAILED)
+    {
+        flock(histFd, LOCK_UN);
+        return {"ERROR: history: cannot read " + historyPath};
+    }
+
+    struct keep { historyMeta m; string cwd, cmd; };
+    vector<keep> kept;
+    size_t before = 0;
+    parseHistoryRecords((const char *)map, size, HIST_HEADER_SIZE,
+        [&](const historyMeta &m, string_view cwd, string_view cmd)
+        {
+            ++before;
+            if (!kept.empty() && kept.back().cmd == cmd) return;
+            kept.push_back({m, string(cwd), string(cmd)});
+        });
+    munmap(map, size);
+    if (kept.size() > HIST_KEEP)
+        kept.erase(kept.begin(), kept.end() - HIST_KEEP);
+
+    string out = historyFileHeader();
+    for (auto &k : kept)
+        out += encodeHistoryRecord(k.m, k.cwd, k.cmd);
+    if (!replaceFileAtomically(historyPath, out))
+    {
+        flock(histFd, LOCK_UN);
+        return {"ERROR: history: compaction failed"};
+    }
+
+    // continue appending to the new file; closing the old one drops its lock
+    // and other instances notice the new inode on their next access
+    int fd = open(historyPath.c_str(), O_RDWR | O_APPEND | O_CLOEXEC);
+    if (fd >= 0)
+        setHistoryFd(fd);
+    else
+        flock(histFd, LOCK_UN);
+
+    resetHistoryMemory();
+    histOffset = out.size();
+    for (auto &k : kept)
+    {
+        inputs.push_back(std::move(k.cmd));
+        histMeta.push_back(k.m);
+    }
+    return {"history: compacted " + to_string(before) + " -> " + to_string(inputs.size()) + " entries"};
+}
+
+vector<string> historyLines()
+{
+    vector<string> out;
+    out.reserve(inputs.size());
+    for (size_t i = 0; i < inputs.size(); ++i)
+    {
+        string prefix = "  " + to_string(histMeta[i].index) + "  ";
+        size_t last = 0, nl;
+        while ((nl = inputs[i].find('\n', last)) != string::npos)
+        {
+            out.push_back(prefix + inputs[i].substr(last, nl - last));
+            prefix = string(prefix.size(), ' ');
+            last = nl + 1;
+        }
+        out.push_back(prefix + inputs[i].substr(last));
+    }
+    return out;
+}
+
+string searchFromHistory(const string &input)
+{
+    TRACE_SCOPE("searchFromHistory");
+    string fullMatch = "";
+    vector<string> allCandidates;
+    int maxLenPrefix = 0;
+
+    for (auto it = inputs.rbegin(); it != inputs.rend(); ++it)
+    {
+        const string &cmd = *it;
+
+        if (cmd == input)
+        {
+            fullMatch = cmd;
+            break;
+        }
+        int prefixLen = getMatchingPrefixLength(cmd, input);
+        if (prefixLen > maxLenPrefix)
+        {
+            maxLenPrefix = prefixLen;
+            allCandidates.clear();
+            allCandidates.push_back(cmd);
+        }
+        else if (prefixLen == maxLenPrefix)
+        {
+            allCandidates.push_back(cmd);
+        }
+    }
+
+    if (!fullMatch.empty())
+        return fullMatch;
+
+    if (maxLenPrefix >= 2)
+        return allCandidates[0];
+
+    return "No match for search term in history";
+}
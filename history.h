@@ -0,0 +1,60 @@
+#pragma once
+#include "headers.h"
+
+//  Command history (history.cpp)
+
+extern string historyPath;
+extern string legacyHistoryPath;
+
+struct historyMeta
+{
+    uint64_t index = 0;
+    int64_t time = 0;
+    int32_t exitCode = -1;
+    uint32_t durationMs = 0;
+};
+
+extern vector<string> inputs;           // history commands (shared by all tabs)
+extern vector<historyMeta> histMeta;    // parallel to inputs
+extern int histFd;
+extern int histWatchFd;                 // inotify on the history file and its directory
+extern uint64_t histReloads;            // bumped whenever inputs is rebuilt from scratch
+extern atomic<bool> histLoadDone;
+
+uint32_t crc32Of(const char *data, size_t n);
+
+template <typename V>
+void putRaw(string &out, V v) { out.append((const char *)&v, sizeof(v)); }
+
+template <typename V>
+V getRaw(const char *p) { V v; memcpy(&v, p, sizeof(v)); return v; }
+
+string encodeHistoryRecord(const historyMeta &m, const string &cwd, const string &cmd);
+string historyFileHeader();
+// Write contents to a temporary file next to path and atomically replace path
+// with it (the history file, session snapshots).
+bool replaceFileAtomically(const string &path, const string &contents);
+void resetHistoryMemory();
+// Open (creating or importing if needed) and load the history file.
+void loadHistory();
+
+// Startup loads history in the background so a big file does not hold up
+// the window; done() then runs on the loading thread. Until
+// awaitHistoryLoad() has returned, inputs, histMeta and histWatchFd belong
+// to that thread.
+void loadHistoryAsync(function<void()> done);
+bool historyLoading();
+// Wait for loadHistoryAsync; true if it had not been waited for yet.
+bool awaitHistoryLoad();
+
+// The inotify fd fired: pick up commands other instances appended.
+// Returns true if inputs changed (histReloads tells whether it was rebuilt).
+bool historyChanged();
+// Append one executed command. Syncing to disk is batched on a helper thread.
+void storeHistory(const string &input, const string &cwd = "", int exitCode = -1, long long durationMs = 0);
+// Rewrite the file without consecutive duplicates, keeping the newest
+// HIST_KEEP entries. Indices are preserved.
+vector<string> compactHistory();
+// `history` builtin: "  <index>  <cmd>" per entry, like the old text log.
+vector<string> historyLines();
+string searchFromHistory(const string &input);
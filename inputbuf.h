@@ -0,0 +1,182 @@
+#pragma once
+#include "headers.h"
+
+//  Input line editor
+//
+// The command being typed lives in a gap buffer: the text before the cursor
+// at the front of buf, the text after it at the back, and unused space in
+// between. Typing or deleting at the cursor only moves the gap when the
+// cursor moved, so editing a long pasted command stays cheap. lineStarts
+// holds the offset of every line so the renderer can find lines and the
+// cursor row without rescanning the text.
+
+struct gapBuffer
+{
+    string buf;              // text with the gap in [gapStart, gapEnd)
+    size_t gapStart = 0;
+    size_t gapEnd = 0;
+    vector<size_t> lineStarts{0}; // logical offset of each line, first is 0
+    size_t highBytes = 0;         // bytes >= 0x80, i.e. the text is not plain ASCII
+
+    size_t gapLen() const { return gapEnd - gapStart; }
+    size_t size() const { return buf.size() - gapLen(); }
+    bool empty() const { return size() == 0; }
+
+    char operator[](size_t i) const
+    {
+        return i < gapStart ? buf[i] : buf[i + gapLen()];
+    }
+
+    // put the gap at logical offset pos
+    void moveGap(size_t pos)
+    {
+        if (pos < gapStart)
+        {
+            size_t n = gapStart - pos;
+            memmove(&buf[gapEnd - n], &buf[pos], n);
+            gapStart -= n;
+            gapEnd -= n;
+        }
+        else if (pos > gapStart)
+        {
+            size_t n = pos - gapStart;
+            memmove(&buf[gapStart], &buf[gapEnd], n);
+            gapStart += n;
+            gapEnd += n;
+        }
+    }
+
+    // make room for at least need more bytes (doubling, gap kept in place)
+    void reserveGap(size_t need)
+    {
+        if (gapLen() >= need)
+            return;
+        size_t tail = buf.size() - gapEnd;
+        size_t newSize = max(buf.size() * 2, size() + need + 64);
+        buf.resize(newSize);
+        if (tail > 0)
+            memmove(&buf[newSize - tail], &buf[gapEnd], tail);
+        gapEnd = newSize - tail;
+    }
+
+    void insert(size_t pos, const char *s, size_t n)
+    {
+        if (n == 0)
+            return;
+        pos = min(pos, size());
+        reserveGap(n);
+        moveGap(pos);
+        memcpy(&buf[gapStart], s, n);
+        gapStart += n;
+
+        // lines after pos move right; every '\n' inserted starts a new line
+        auto it = upper_bound(lineStarts.begin(), lineStarts.end(), pos);
+        for (auto j = it; j != lineStarts.end(); ++j)
+            *j += n;
+        vector<size_t> added;
+        for (size_t i = 0; i < n; ++i)
+        {
+            if (s[i] == '\n')
+                added.push_back(pos + i + 1);
+            highBytes += ((unsigned char)s[i] >= 0x80);
+        }
+        lineStarts.insert(it, added.begin(), added.end());
+    }
+
+    void insert(size_t pos, char c) { insert(pos, &c, 1); }
+
+    void erase(size_t pos, size_t n = 1)
+    {
+        if (pos >= size())
+            return;
+        n = min(n, size() - pos);
+        moveGap(pos);
+        for (size_t i = gapEnd; i < gapEnd + n; ++i)
+            highBytes -= ((unsigned char)buf[i] >= 0x80);
+        gapEnd += n;
+
+        // drop the lines whose newline was erased, shift the rest left
+        auto from = upper_bound(lineStarts.begin(), lineStarts.end(), pos);
+        auto to = upper_bound(from, lineStarts.end(), pos + n);
+        for (auto j = to; j != lineStarts.end(); ++j)
+            *j -= n;
+        lineStarts.erase(from, to);
+    }
+
+    void clear()
+    {
+        buf.clear();
+        gapStart = gapEnd = 0;
+        lineStarts.assign(1, 0);
+        highBytes = 0;
+    }
+
+    gapBuffer &operator=(const string &s)
+    {
+        clear();
+        insert(0, s.data(), s.size());
+        return *this;
+    }
+
+    gapBuffer &operator+=(const string &s)
+    {
+        insert(size(), s.data(), s.size());
+        return *this;
+    }
+
+    gapBuffer &operator+=(char c)
+    {
+        insert(size(), c);
+        return *this;
+    }
+
+    string substr(size_t pos, size_t n = string::npos) const
+    {
+        pos = min(pos, size());
+        n = min(n, size() - pos);
+        string out;
+        out.reserve(n);
+        size_t end = pos + n;
+        if (pos < gapStart)
+            out.append(buf, pos, min(end, gapStart) - pos);
+        if (end > gapStart)
+        {
+            size_t from = max(pos, gapStart);
+            out.append(buf, from + gapLen(), end - from);
+        }
+        return out;
+    }
+
+    string str() const { return substr(0); }
+
+    bool operator==(const string &s) const
+    {
+        return size() == s.size() && str() == s;
+    }
+    bool operator!=(const string &s) const { return !(*this == s); }
+
+    size_t lineCount() const { return lineStarts.size(); }
+    size_t lineStart(size_t l) const { return lineStarts[l]; }
+
+    // offset just past the last character of line l (its '\n' or the end)
+    size_t lineEnd(size_t l) const
+    {
+        return (l + 1 < lineStarts.size()) ? lineStarts[l + 1] - 1 : size();
+    }
+
+    size_t lineOf(size_t pos) const
+    {
+        return (size_t)(upper_bound(lineStarts.begin(), lineStarts.end(), pos) - lineStarts.begin()) - 1;
+    }
+
+    string line(size_t l) const { return substr(lineStart(l), lineEnd(l) - lineStart(l)); }
+
+    size_t count(char c) const
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < buf.size(); ++i)
+            if ((i < gapStart || i >= gapEnd) && buf[i] == c)
+                ++n;
+        return n;
+    }
+};
@@ -0,0 +1,431 @@
+#include "jobs.h"
+
+//  Per-tab job table
+//
+// Every pipeline we fork runs in its own process group and is recorded here
+// under the id of the tab that started it, so interrupts and job control only
+// touch processes that belong to one tab. Jobs whose owner does not wait for
+// them are reaped from the event loop when their pidfd (or the SIGCHLD
+// signalfd) becomes readable; for the others it only picks up stops.
+
+enum jobState
+{
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+};
+
+struct job
+{
+    int id = 0;         // per-tab job number, as shown by `jobs`
+    int tabId = 0;      // owning tab (tabState::id)
+    pid_t pgid = 0;     // process group of the whole pipeline
+    vector<pid_t> pids; // members not reaped yet
+    vector<int> pidfds; // exit notification per member, -1 if none
+    pid_t lastPid = 0;  // last pipeline stage; its exit status is the job's
+    string cmd;
+    jobState state = JOB_RUNNING;
+    bool background = false;
+    bool ownerWaits = false; // reaped by whoever started it, not by reapJobs
+    bool listed = true;      // shown by jobs, reachable by fg / bg
+    bool outputOpen = false; // streamJobOutput has not posted all its lines yet
+    int status = 0;          // wait status of the last pipeline member
+};
+
+static mutex jobsMutex;
+static map<int, vector<job>> jobTable; // tabId -> jobs, guarded by jobsMutex
+
+// Child lifecycle notification for the event loop: one pidfd per child when
+// the kernel has pidfd_open (5.3+), otherwise a single signalfd for SIGCHLD.
+static bool pidfdOk = false;
+static int sigchldFd = -1;
+
+atomic<bool> reapPending(false);
+// pidfds only report exits; after we stop/continue a job keep re-checking
+// for a short while so the state change is picked up promptly. Written under
+// jobsMutex, read by the event loop without it: steady_clock ticks.
+static atomic<int64_t> jobWatchUntil(0);
+
+void initChildWatch()
+{
+    int fd = (int)syscall(SYS_pidfd_open, getpid(), 0);
+    if (fd >= 0)
+    {
+        close(fd);
+        pidfdOk = true;
+        return;
+    }
+
+    // Fallback: SIGCHLD must be blocked in every thread for signalfd to see it,
+    // so this runs before any worker thread exists.
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+    sigchldFd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+}
+
+int openPidfd(pid_t pid)
+{
+    if (!pidfdOk) return -1;
+    return (int)syscall(SYS_pidfd_open, pid, 0);
+}
+
+void resetChildSignals()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigprocmask(SIG_SETMASK, &set, nullptr);
+}
+
+bool waitChildExit(pid_t pid, int pidfd, int timeoutMs)
+{
+    if (pidfd >= 0)
+    {
+        struct pollfd p{pidfd, POLLIN, 0};
+        int r;
+        while ((r = poll(&p, 1, timeoutMs)) < 0 && errno == EINTR) {}
+        return r > 0;
+    }
+
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+    while (true)
+    {
+        siginfo_t si{};
+        if (waitid(P_PID, pid, &si, WEXITED | WNOHANG | WNOWAIT) == 0 && si.si_pid == pid)
+            return true;
+        if (chrono::steady_clock::now() >= deadline)
+            return false;
+        this_thread::sleep_for(chrono::milliseconds(2));
+    }
+}
+
+static void expectJobStateChange()
+{
+    reapPending = true;
+    jobWatchUntil = (chrono::steady_clock::now() + chrono::seconds(1)).time_since_epoch().count();
+}
+
+bool jobStateChangeExpected()
+{
+    return chrono::steady_clock::now().time_since_epoch().count() < jobWatchUntil.load();
+}
+
+static string jobStateName(jobState s)
+{
+    if (s == JOB_RUNNING) return "Running";
+    if (s == JOB_STOPPED) return "Stopped";
+    return "Done";
+}
+
+static string jobLine(const job &j)
+{
+    string st = jobStateName(j.state);
+    if (j.state == JOB_DONE && WIFEXITED(j.status) && WEXITSTATUS(j.status) != 0)
+        st = "Exit " + to_string(WEXITSTATUS(j.status));
+    else if (j.state == JOB_DONE && WIFSIGNALED(j.status))
+        st = string(strsignal(WTERMSIG(j.status)));
+    st.resize(max<size_t>(st.size(), 10), ' ');
+    return "[" + to_string(j.id) + "]  " + st + "  " + j.cmd;
+}
+
+void joinJobGroup(pid_t pid, pid_t &pgid)
+{
+    if (pgid == 0) pgid = pid;
+    setpgid(pid, pgid);
+}
+
+int registerJob(int tabId, pid_t pgid, const vector<pid_t> &pids, const string &cmd,
+                bool background, bool ownerWaits, bool listed)
+{
+    lock_guard<mutex> lk(jobsMutex);
+    auto &list = jobTable[tabId];
+    int id = 1;
+    for (auto &j : list) id = max(id, j.id + 1);
+
+    job j;
+    j.id = id;
+    j.tabId = tabId;
+    j.pgid = pgid;
+    j.pids = pids;
+    j.lastPid = pids.empty() ? 0 : pids.back();
+    j.cmd = cmd;
+    j.background = background;
+    j.ownerWaits = ownerWaits;
+    j.listed = listed;
+    j.outputOpen = background;
+    // the event loop watches jobs it has to reap; owners watch their own
+    for (pid_t p : pids)
+        j.pidfds.push_back(ownerWaits ? -1 : openPidfd(p));
+    list.push_back(std::move(j));
+    return id;
+}
+
+string forgetJob(int tabId, pid_t pgid, int status)
+{
+    lock_guard<mutex> lk(jobsMutex);
+    auto it = jobTable.find(tabId);
+    if (it == jobTable.end()) return "";
+    auto &list = it->second;
+    string note;
+    for (auto &j : list)
+        if (j.pgid == pgid)
+        {
+            for (int fd : j.pidfds) if (fd >= 0) close(fd);
+            if (j.background && j.listed)
+            {
+                j.state = JOB_DONE;
+                j.status = status;
+                note = jobLine(j);
+            }
+        }
+    list.erase(remove_if(list.begin(), list.end(), [&](const job &j){ return j.pgid == pgid; }), list.end());
+    if (list.empty()) jobTable.erase(it);
+    return note;
+}
+
+void jobOutputDrained(int tabId, pid_t pgid)
+{
+    lock_guard<mutex> lk(jobsMutex);
+    auto it = jobTable.find(tabId);
+    if (it == jobTable.end()) return;
+    for (auto &j : it->second)
+        if (j.pgid == pgid) j.outputOpen = false;
+    reapPending = true;
+}
+
+int shellStatus(int status)
+{
+    if (WIFSIGNALED(status)) return 128 + WTERMSIG(status);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 0;
+}
+
+bool signalForeground(int tabId, int sig)
+{
+    lock_guard<mutex> lk(jobsMutex);
+    auto it = jobTable.find(tabId);
+    if (it == jobTable.end()) return false;
+    bool any = false;
+    for (auto &j : it->second)
+    {
+        if (j.background || j.state == JOB_DONE || j.pgid <= 0) continue;
+        kill(-j.pgid, sig);
+        any = true;
+    }
+    if (any) expectJobStateChange();
+    return any;
+}
+
+void hangupTabJobs(int tabId)
+{
+    lock_guard<mutex> lk(jobsMutex);
+    auto it = jobTable.find(tabId);
+    if (it == jobTable.end()) return;
+    for (auto &j : it->second)
+    {
+        if (j.state == JOB_DONE || j.pgid <= 0) continue;
+        kill(-j.pgid, SIGHUP);
+        kill(-j.pgid, SIGCONT);
+    }
+    reapPending = true;
+}
+
+void addChildWatchFds(vector<struct pollfd> &pfds)
+{
+    if (sigchldFd >= 0)
+    {
+        pfds.push_back({sigchldFd, POLLIN, 0});
+        return;
+    }
+    lock_guard<mutex> lk(jobsMutex);
+    for (auto &[tabId, list] : jobTable)
+        for (auto &j : list)
+            for (int fd : j.pidfds)
+                if (fd >= 0) pfds.push_back({fd, POLLIN, 0});
+}
+
+bool childWatchFired(const vector<struct pollfd> &pfds, size_t from)
+{
+    bool fired = false;
+    for (size_t i = from; i < pfds.size(); ++i)
+        if (pfds[i].revents) fired = true;
+    if (fired && sigchldFd >= 0)
+    {
+        struct signalfd_siginfo si;
+        while (read(sigchldFd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {}
+    }
+    return fired;
+}
+
+vector<jobNote> reapJobs()
+{
+    vector<jobNote> notes;
+    lock_guard<mutex> lk(jobsMutex);
+    for (auto tit = jobTable.begin(); tit != jobTable.end();)
+    {
+        auto &list = tit->second;
+        for (auto jit = list.begin(); jit != list.end();)
+        {
+            job &j = *jit;
+            if (j.ownerWaits)
+            {
+                // exits are the owner's to reap, stops are still reported here
+                for (pid_t pid : j.pids)
+                {
+                    siginfo_t si{};
+                    if (waitid(P_PID, pid, &si, WSTOPPED | WCONTINUED | WNOHANG) != 0 || si.si_pid != pid)
+                        continue;
+                    if (si.si_code == CLD_STOPPED && j.state != JOB_STOPPED)
+                    {
+                        j.state = JOB_STOPPED;
+                        j.background = true;
+                        notes.push_back({j.tabId, j.pgid, jobLine(j), false, 0});
+                    }
+                    else if (si.si_code == CLD_CONTINUED)
+                        j.state = JOB_RUNNING;
+                }
+                ++jit;
+                continue;
+            }
+
+            bool changed = false;
+            for (size_t k = j.pids.size(); k-- > 0;)
+            {
+                pid_t pid = j.pids[k];
+                int status = 0;
+                pid_t r = waitpid(pid, &status, WNOHANG | WUNTRACED | WCONTINUED);
+                bool gone = (r == pid && (WIFEXITED(status) || WIFSIGNALED(status))) || (r < 0 && errno == ECHILD);
+                if (gone)
+                {
+                    if (pid == j.lastPid && r == pid) j.status = status;
+                    if (j.pidfds[k] >= 0) close(j.pidfds[k]);
+                    j.pids.erase(j.pids.begin() + k);
+                    j.pidfds.erase(j.pidfds.begin() + k);
+                    continue;
+                }
+                if (r == pid && WIFSTOPPED(status) && j.state != JOB_STOPPED)
+                {
+                    j.state = JOB_STOPPED;
+                    j.background = true;
+                    changed = true;
+                }
+                else if (r == pid && WIFCONTINUED(status))
+                    j.state = JOB_RUNNING;
+            }
+
+            // reported once its output is on screen, so the note comes last
+            if (j.pids.empty() && !j.outputOpen)
+            {
+                j.state = JOB_DONE;
+                notes.push_back({j.tabId, j.pgid, jobLine(j), true, j.status});
+                jit = list.erase(jit);
+                continue;
+            }
+            if (changed)
+                notes.push_back({j.tabId, j.pgid, jobLine(j), false, 0});
+            ++jit;
+        }
+        if (list.empty()) tit = jobTable.erase(tit);
+        else ++tit;
+    }
+    return notes;
+}
+
+// `%N`, `N` or empty (most recent job) -> job; returns nullptr if none.
+// Caller must hold jobsMutex.
+static job *findJob(int tabId, const string &spec)
+{
+    auto it = jobTable.find(tabId);
+    if (it == jobTable.end() || it->second.empty()) return nullptr;
+    auto &list = it->second;
+
+    string s = spec;
+    if (!s.empty() && s[0] == '%') s = s.substr(1);
+    if (s.empty() || s == "+")
+    {
+        for (auto jit = list.rbegin(); jit != list.rend(); ++jit)
+            if (jit->listed) return &*jit;
+        return nullptr;
+    }
+    if (s.find_first_not_of("0123456789") != string::npos) return nullptr;
+    int id = stoi(s);
+    for (auto &j : list)
+        if (j.id == id && j.listed) return &j;
+    return nullptr;
+}
+
+vector<string> jobsBuiltin(int tabId)
+{
+    vector<string> out;
+    lock_guard<mutex> lk(jobsMutex);
+    auto it = jobTable.find(tabId);
+    if (it != jobTable.end())
+        for (auto &j : it->second)
+            if (j.listed) out.push_back(jobLine(j));
+    if (out.empty()) out.push_back("");
+    return out;
+}
+
+vector<string> fgBuiltin(int tabId, const string &spec, pid_t &pgid)
+{
+    lock_guard<mutex> lk(jobsMutex);
+    job *j = findJob(tabId, spec);
+    pgid = j ? j->pgid : 0;
+    if (!j) return {"ERROR: fg: " + (spec.empty() ? string("current") : spec) + ": no such job"};
+    j->background = false;
+    j->state = JOB_RUNNING;
+    kill(-j->pgid, SIGCONT);
+    expectJobStateChange();
+    return {j->cmd};
+}
+
+vector<string> bgBuiltin(int tabId, const string &spec)
+{
+    lock_guard<mutex> lk(jobsMutex);
+    job *j = findJob(tabId, spec);
+    if (!j) return {"ERROR: bg: " + (spec.empty() ? string("current") : spec) + ": no such job"};
+    j->background = true;
+    j->state = JOB_RUNNING;
+    kill(-j->pgid, SIGCONT);
+    expectJobStateChange();
+    return {"[" + to_string(j->id) + "]  " + j->cmd + " &"};
+}
+
+mutex watchMutex;
+static map<int, shared_ptr<tabWatch>> tabWatches; // tabId -> running watch, guarded by watchMutex
+
+void stopWatch(int tabId)
+{
+    lock_guard<mutex> lk(watchMutex);
+    auto it = tabWatches.find(tabId);
+    if (it == tabWatches.end()) return;
+    it->second->stop.store(true);
+    it->second->cv.notify_all();
+}
+
+shared_ptr<tabWatch> startWatch(int tabId)
+{
+    stopWatch(tabId);
+    auto w = make_shared<tabWatch>();
+    lock_guard<mutex> lk(watchMutex);
+    tabWatches[tabId] = w;
+    return w;
+}
+
+void finishWatch(int tabId, const shared_ptr<tabWatch> &w)
+{
+    lock_guard<mutex> lk(watchMutex);
+    w->done = true;
+    auto it = tabWatches.find(tabId);
+    if (it != tabWatches.end() && it->second == w) tabWatches.erase(it);
+    w->cv.notify_all();
+}
+
+void awaitWatchEnd(int tabId, chrono::milliseconds timeout)
+{
+    unique_lock<mutex> lk(watchMutex);
+    auto it = tabWatches.find(tabId);
+    if (it == tabWatches.end()) return;
+    shared_ptr<tabWatch> w = it->second;
+    w->cv.wait_for(lk, timeout, [&]{ return w->done; });
+}
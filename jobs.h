@@ -0,0 +1,98 @@
+#pragma once
+#include "headers.h"
+
+//  Per-tab job table (jobs.cpp)
+
+// a reap pass is due (child exited, job resumed/stopped by us, new bg job,
+// output of a job drained); set from worker threads too
+extern atomic<bool> reapPending;
+
+void initChildWatch();
+
+// pidfd for a child, or -1 when unsupported (pidfds are always close-on-exec)
+int openPidfd(pid_t pid);
+
+// In a forked child before exec: drop the parent's SIGCHLD block.
+void resetChildSignals();
+
+// Wait up to timeoutMs for pid to exit without reaping it.
+bool waitChildExit(pid_t pid, int pidfd, int timeoutMs);
+
+bool jobStateChangeExpected();
+
+// Put a freshly forked child into the pipeline's process group. Called on both
+// sides of fork() so the group exists whichever runs first.
+void joinJobGroup(pid_t pid, pid_t &pgid);
+
+// Record a new job for tabId and return its job number. An owner that waits
+// reaps the exits itself; unlisted jobs are left out of jobs, fg and bg.
+int registerJob(int tabId, pid_t pgid, const vector<pid_t> &pids, const string &cmd,
+                bool background, bool ownerWaits, bool listed);
+
+// The owner has reaped the job (status: wait status of its last stage).
+// Returns its Done note if it had been moved to the background, else "".
+string forgetJob(int tabId, pid_t pgid, int status = 0);
+
+// streamJobOutput has queued the last line of the job; its Done note may follow.
+void jobOutputDrained(int tabId, pid_t pgid);
+
+// $? for a wait status: the exit code, 128+N if killed by signal N.
+int shellStatus(int status);
+
+// Send sig to every foreground job of a tab (Ctrl+C / Ctrl+Z).
+bool signalForeground(int tabId, int sig);
+
+// Tab is closing: hang up its jobs. They stay in the table until reaped.
+void hangupTabJobs(int tabId);
+
+// Add what the event loop has to poll for child state changes.
+void addChildWatchFds(vector<struct pollfd> &pfds);
+
+// After poll(): did any of the child watch fds (from index `from`) fire?
+bool childWatchFired(const vector<struct pollfd> &pfds, size_t from);
+
+// A job that stopped or finished, as reapJobs reports it.
+struct jobNote
+{
+    int tabId;
+    pid_t pgid;
+    string line; // as jobs shows it
+    bool done;
+    int status;  // wait status of the last stage, when done
+};
+
+// Non-blocking reap of every job the event loop is responsible for, and a
+// check for stops of the ones their owners wait for.
+vector<jobNote> reapJobs();
+
+// jobs / fg / bg builtins. Returns the lines to print.
+vector<string> jobsBuiltin(int tabId);
+
+// pgid is set to the resumed job's group, 0 if there is none.
+vector<string> fgBuiltin(int tabId, const string &spec, pid_t &pgid);
+
+vector<string> bgBuiltin(int tabId, const string &spec);
+
+// A running multiWatch. Each tab has at most one, and its stop and done flags
+// are its own, so Ctrl+C in one tab never touches another tab's watcher.
+struct tabWatch
+{
+    atomic<bool> stop{false};
+    bool done = false;     // guarded by watchMutex
+    condition_variable cv; // signalled on stop and when done
+};
+
+extern mutex watchMutex;
+
+// Stop request for tabId's watch, if it has one.
+void stopWatch(int tabId);
+
+// A new watch for tabId; one it already had is told to stop.
+shared_ptr<tabWatch> startWatch(int tabId);
+
+// Called by the watcher as it exits.
+void finishWatch(int tabId, const shared_ptr<tabWatch> &w);
+
+// Wait up to timeout for tabId's watch to finish; returns at once if the tab
+// has none running.
+void awaitWatchEnd(int tabId, chrono::milliseconds timeout);
@@ -0,0 +1,151 @@
+#include "record.h"
+#include "counters.h"
+
+//  Session recording
+//
+// SHRETERM_RECORD=FILE writes everything that drives the terminal to FILE:
+// window sizes, key presses after input-method lookup, pointer events and
+// pasted text, and what came back from outside: the output of each command,
+// lines from background jobs and workers, and multiWatch frames. replay.cpp
+// feeds a recording back through the same handlers with the recorded outputs
+// standing in for the commands, so a real session becomes a repeatable
+// benchmark. Only the event loop thread records.
+//
+// After the line "shreterm-session 1" there is one record per line: a tag,
+// microseconds since the recording started, then the fields. Numbers come
+// before strings, and strings are written as LENGTH:BYTES so they may hold
+// anything, newlines included.
+//   H t ENTRY...                      history when the recording started
+//   S t W H                           window size
+//   K t KEYSYM STATE FIRST TEXT       key press (keyInput)
+//   B t X Y BUTTON                    button press
+//   P t X Y                           pointer moved (-1 -1: left the window)
+//   V t TAB TEXT                      pasted chunk
+//   W t TAB                           paste finished (TAB -1: its tab is gone)
+//   O t STATUS CMD CWD LINE...        command output, then the tab's status and cwd
+//   M t TAB LINE                      line from a background job or worker
+//   F t TAB LINE...                   multiWatch frame shown
+
+static const char *SESSION_MAGIC = "shreterm-session 1";
+
+static ofstream recordOut;
+static chrono::steady_clock::time_point recordStart;
+
+bool recording() { return recordOut.is_open(); }
+
+void recordEvent(char tag, initializer_list<long long> nums, const vector<string> &strs)
+{
+    if (!recording())
+        return;
+    string rec(1, tag);
+    rec += ' ' + to_string(usSince(recordStart));
+    for (long long n : nums)
+        rec += ' ' + to_string(n);
+    for (const string &s : strs)
+    {
+        rec += ' ' + to_string(s.size()) + ':';
+        rec += s;
+    }
+    rec += '\n';
+    recordOut.write(rec.data(), (streamsize)rec.size());
+    recordOut.flush();
+}
+
+bool recordBegin(const string &path, const vector<string> &history)
+{
+    recordOut.open(path, ios::binary | ios::trunc);
+    if (!recordOut)
+        return false;
+    recordStart = chrono::steady_clock::now();
+    recordOut << SESSION_MAGIC << "\n";
+    recordEvent('H', {}, history);
+    return true;
+}
+
+bool readSession(const string &path, vector<sessionRecord> &out, string &error)
+{
+    ifstream in(path, ios::binary);
+    if (!in)
+    {
+        error = "cannot open " + path;
+        return false;
+    }
+    string data((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+    size_t magic = strlen(SESSION_MAGIC);
+    if (data.compare(0, magic, SESSION_MAGIC) != 0 || data.size() <= magic || data[magic] != '\n')
+    {
+        error = path + " is not a session recording";
+        return false;
+    }
+
+    size_t p = magic + 1;
+    while (p < data.size())
+    {
+        sessionRecord r;
+        r.tag = data[p++];
+        bool first = true;
+        while (p < data.size() && data[p] == ' ')
+        {
+            ++p;
+            char *end;
+            long long n = strtoll(data.c_str() + p, &end, 10);
+            size_t q = (size_t)(end - data.c_str());
+            if (q == p)
+                break;
+            p = q;
+            if (p < data.size() && data[p] == ':')
+            {
+                if (n < 0 || (size_t)n > data.size() - p - 1)
+                    break;
+                r.strs.push_back(data.substr(p + 1, (size_t)n));
+                p += 1 + (size_t)n;
+            }
+            else if (first)
+                r.us = (uint64_t)n;
+            else
+                r.nums.push_back(n);
+            first = false;
+        }
+        if (p >= data.size() || data[p] != '\n')
+        {
+            // a record cut short by a crash ends the recording
+            if (p < data.size())
+                cerr << "replay: " << path << ": bad record at byte " << p << ", stopping there\n";
+            break;
+        }
+        ++p;
+        out.push_back(std::move(r));
+    }
+    return true;
+}
+
+bool replaying = false;
+vector<sessionRecord> replayRecords;
+size_t replayPos = 0;
+uint64_t replayDiverged = 0;
+
+const sessionRecord *replayTake(char tag)
+{
+    while (replayPos < replayRecords.size() && replayRecords[replayPos].tag == REPLAY_USED)
+        replayPos++;
+    if (replayPos < replayRecords.size() && replayRecords[replayPos].tag == tag)
+        return &replayRecords[replayPos++];
+    return nullptr;
+}
+
+const sessionRecord *replayTakeOutput(int tabId)
+{
+    for (size_t i = replayPos; i < replayRecords.size(); ++i)
+    {
+        sessionRecord &r = replayRecords[i];
+        if (r.tag == 'O' && (r.nums.size() < 2 || r.nums[1] == tabId))
+        {
+            if (i == replayPos)
+                replayPos++;
+            else
+                r.tag = REPLAY_USED;
+            return &r;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include "headers.h"
+
+//  Session recording and replay state (record.cpp)
+
+struct sessionRecord
+{
+    char tag = 0;
+    uint64_t us = 0;
+    vector<long long> nums;
+    vector<string> strs;
+};
+
+bool recording();
+// Records are flushed one by one so a crash loses nothing before it.
+void recordEvent(char tag, initializer_list<long long> nums, const vector<string> &strs = {});
+bool recordBegin(const string &path, const vector<string> &history);
+// Parse a recording; false (and why) if it is not one.
+bool readSession(const string &path, vector<sessionRecord> &out, string &error);
+
+// Replay state: the records, and the next one to hand out. Outputs are taken
+// from here in place of running commands while replaying.
+extern bool replaying;
+extern vector<sessionRecord> replayRecords;
+extern size_t replayPos;
+extern uint64_t replayDiverged; // command outputs that did not line up
+
+const char REPLAY_USED = '-'; // tag of a record handled ahead of its place
+
+// The next record if it has the given tag.
+const sessionRecord *replayTake(char tag);
+
+// The next command output recorded for tabId ('O': status, tab id; command,
+// cwd, lines). A command that ran on while other events came in was recorded
+// when it ended, so it is looked for further on, and marked as taken there.
+const sessionRecord *replayTakeOutput(int tabId);
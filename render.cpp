@@ -0,0 +1,77 @@
+#include "render.h"
+
+//  Renderers
+//
+// Everything the terminal draws goes through a renderer: the X window
+// (xRenderer, draw.cpp) or an in-memory framebuffer (fbRenderer) used when
+// running headless. Colours are 0xRRGGBB, text is UTF-8 on a monospace grid and y
+// is the text baseline, as in Xlib.
+
+void fbRenderer::resize(int w, int h)
+{
+    width = max(1, w);
+    height = max(1, h);
+    pixels.assign((size_t)width * height, 0);
+    cols = width / CELL_W;
+    rows = height / (ASCENT + DESCENT);
+    cells.assign((size_t)cols * rows, 0);
+}
+
+void fbRenderer::fill(int x, int y, int w, int h, uint32_t rgb, bool clearText)
+{
+    int x0 = max(0, x), y0 = max(0, y);
+    int x1 = min(width, x + w), y1 = min(height, y + h);
+    for (int yy = y0; yy < y1; ++yy)
+        std::fill(pixels.begin() + (size_t)yy * width + x0, pixels.begin() + (size_t)yy * width + max(x0, x1), rgb);
+    if (!clearText)
+        return;
+    // cells entirely inside the area lose their text
+    for (int r = (y0 + lineH() - 1) / lineH(); r < rows && (r + 1) * lineH() <= y1; ++r)
+        for (int c = (x0 + CELL_W - 1) / CELL_W; c < cols && (c + 1) * CELL_W <= x1; ++c)
+            cells[(size_t)r * cols + c] = 0;
+}
+
+void fbRenderer::drawRect(int x, int y, int w, int h, unsigned long rgb)
+{
+    fill(x, y, w + 1, 1, (uint32_t)rgb, false);
+    fill(x, y + h, w + 1, 1, (uint32_t)rgb, false);
+    fill(x, y, 1, h + 1, (uint32_t)rgb, false);
+    fill(x + w, y, 1, h + 1, (uint32_t)rgb, false);
+}
+
+int fbRenderer::drawText(int x, int y, const char *s, size_t n, unsigned long rgb)
+{
+    int r = (y - ASCENT) / lineH();
+    int cx = x;
+    for (size_t i = 0; i < n;)
+    {
+        size_t used;
+        uint32_t cp = decodeUtf8(s + i, n - i, used);
+        i += used;
+        int w = charCells(cp);
+        int c = cx / CELL_W;
+        if (w > 0 && r >= 0 && r < rows && c >= 0 && c < cols)
+        {
+            cells[(size_t)r * cols + c] = cp;
+            // a solid block where the glyph goes keeps the pixels honest
+            fill(cx, y - ASCENT + 2, w * CELL_W - 1, ASCENT, (uint32_t)rgb, false);
+        }
+        cx += w * CELL_W;
+    }
+    return cx - x;
+}
+
+string fbRenderer::rowText(int r) const
+{
+    string out;
+    for (int c = 0; c < cols; ++c)
+    {
+        uint32_t cp = cells[(size_t)r * cols + c];
+        if (cp)
+            appendUtf8(out, cp);
+        else if (c == 0 || charCells(cells[(size_t)r * cols + c - 1]) < 2) // not the right half of a wide char
+            out += ' ';
+    }
+    out.erase(out.find_last_not_of(' ') + 1);
+    return out;
+}
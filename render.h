@@ -0,0 +1,63 @@
+#pragma once
+#include "text.h"
+
+//  Renderers (render.cpp)
+
+struct renderer
+{
+    virtual ~renderer() {}
+
+    virtual int ascent() const = 0;
+    virtual int descent() const = 0;
+    virtual int cellW() const = 0;
+    int lineH() const { return ascent() + descent(); }
+    int textWidth(const char *s, size_t n) const { return (int)textCells(s, n) * cellW(); }
+
+    virtual void clear(int x, int y, int w, int h) = 0; // to the background (black)
+    virtual void fillRect(int x, int y, int w, int h, unsigned long rgb) = 0;
+    virtual void drawRect(int x, int y, int w, int h, unsigned long rgb) = 0;
+    virtual void fillArc(int x, int y, int w, int h, int angle1, int angle2, unsigned long rgb) = 0;
+    virtual void drawLine(int x1, int y1, int x2, int y2, unsigned long rgb) = 0;
+    // returns the advance in pixels
+    virtual int drawText(int x, int y, const char *s, size_t n, unsigned long rgb) = 0;
+    // draw anything still queued (text is batched by some renderers)
+    virtual void flush() {}
+
+    // ask for the clipboard; the text arrives later through the event loop
+    virtual void requestPaste() {}
+};
+
+// Pixels plus the character drawn in each text cell, so a headless run can
+// be checked (and timed) by reading the screen back as text. Arcs are
+// filled as their bounding box.
+struct fbRenderer : renderer
+{
+    int width, height;
+    vector<uint32_t> pixels;    // width * height, 0xRRGGBB
+    int cols, rows;
+    vector<uint32_t> cells;     // codepoint per cell, 0 = empty
+    static const int ASCENT = 12, DESCENT = 4, CELL_W = 8;
+
+    fbRenderer(int w, int h) { resize(w, h); }
+
+    void resize(int w, int h);
+
+    int ascent() const override { return ASCENT; }
+    int descent() const override { return DESCENT; }
+    int cellW() const override { return CELL_W; }
+
+    void fill(int x, int y, int w, int h, uint32_t rgb, bool clearText);
+
+    void clear(int x, int y, int w, int h) override { fill(x, y, w, h, 0x000000, true); }
+    void fillRect(int x, int y, int w, int h, unsigned long rgb) override { fill(x, y, w, h, (uint32_t)rgb, false); }
+    void drawRect(int x, int y, int w, int h, unsigned long rgb) override;
+    void fillArc(int x, int y, int w, int h, int, int, unsigned long rgb) override { fill(x, y, w, h, (uint32_t)rgb, false); }
+    void drawLine(int x1, int y1, int x2, int y2, unsigned long rgb) override
+    {
+        fill(min(x1, x2), min(y1, y2), abs(x2 - x1) + 1, abs(y2 - y1) + 1, (uint32_t)rgb, false);
+    }
+    int drawText(int x, int y, const char *s, size_t n, unsigned long rgb) override;
+
+    // text of cell row r, trailing blanks dropped
+    string rowText(int r) const;
+};
@@ -0,0 +1,193 @@
+#include "replay.h"
+#include "core.h"
+#include "exec.h"
+#include "history.h"
+#include "record.h"
+#include "termstat.h"
+
+//  Session replay
+//
+// Feeds a recording (record.cpp) back through the handlers the event loop
+// uses, as fast as they run. Recorded outputs stand in for commands, and
+// background lines and multiWatch frames are injected where they arrived,
+// so nothing is executed and every run of the same file does the same work.
+// Each event is timed from hand-off until it is drawn, including whatever
+// sync() adds (the round trip to the server on a real display), and the
+// report gives the times by kind of event.
+//
+// The terminal should be as run() leaves it before its first event: one tab
+// at "/". History is replaced by the recorded one and never written. Big
+// find scans, which only run while the event loop is idle, are not waited for.
+
+// Frames are recorded when shown, which may be in the middle of handling an
+// input (Ctrl+C shows the screen from before a multiWatch, then adds "^C").
+// So the frames recorded after an input are posted before it is handled; a
+// frame replaces the whole screen, so one shown just after the input ends up
+// the same.
+static void replayFramesAhead()
+{
+    for (size_t i = replayPos; i < replayRecords.size(); ++i)
+    {
+        sessionRecord &r = replayRecords[i];
+        if (r.tag == 'F' && !r.nums.empty())
+        {
+            postFrame((int)r.nums[0], std::move(r.strs));
+            r.tag = REPLAY_USED;
+        }
+        else if (r.tag != 'O' && r.tag != REPLAY_USED)
+            break;
+    }
+}
+
+struct replayTimes
+{
+    vector<double> key, enter, button, pointer, resize, paste, output, frame;
+};
+
+static void replayReportLine(ostream &out, const char *name, vector<double> &t)
+{
+    if (t.empty())
+        return;
+    sort(t.begin(), t.end());
+    double total = accumulate(t.begin(), t.end(), 0.0);
+    // nearest rank
+    auto pct = [&](double p) { return t[min(t.size() - 1, (size_t)ceil(p * t.size()) - 1)]; };
+    char line[128];
+    snprintf(line, sizeof(line), "  %-8s n=%-7zu total %9.2f ms  p50 %8.3f ms  p99 %8.3f ms  max %8.3f ms", name,
+             t.size(), total * 1e3, pct(0.50) * 1e3, pct(0.99) * 1e3, t.back() * 1e3);
+    out << line << "\n";
+}
+
+bool replaySession(renderer &R, const string &path, const function<void(int, int)> &resize,
+                   const function<void()> &sync, ostream &out)
+{
+    string error;
+    replayRecords.clear();
+    if (!readSession(path, replayRecords, error))
+    {
+        out << "replay: " << error << "\n";
+        return false;
+    }
+    replaying = true;
+    replayPos = 0;
+    replayDiverged = 0;
+
+    replayTimes times;
+    size_t strayOutputs = 0;
+    auto started = chrono::steady_clock::now();
+    while (replayPos < replayRecords.size())
+    {
+        const sessionRecord &r = replayRecords[replayPos++];
+        auto num = [&](size_t i) { return i < r.nums.size() ? r.nums[i] : 0; };
+        auto t0 = chrono::steady_clock::now();
+        vector<double> *kind = nullptr;
+        bool open = true;
+        if (r.tag && strchr("SKBPVW", r.tag))
+            replayFramesAhead();
+
+        switch (r.tag)
+        {
+        case 'H':
+            resetHistoryMemory();
+            for (auto &entry : r.strs)
+            {
+                historyMeta m;
+                m.index = inputs.size() + 1;
+                inputs.push_back(entry);
+                histMeta.push_back(m);
+            }
+            for (auto &t : tabs)
+                t.inpIdx = (int)inputs.size();
+            continue;
+        case 'O':
+            // output no command asked for: the replay has drifted
+            strayOutputs++;
+            continue;
+        case 'S':
+            resize((int)num(0), (int)num(1));
+            handleResize(R, (int)num(0), (int)num(1));
+            kind = &times.resize;
+            break;
+        case 'K':
+        {
+            keyInput k;
+            k.keysym = (KeySym)num(0);
+            k.state = (unsigned)num(1);
+            k.first = (wchar_t)num(2);
+            k.chars = k.first != 0;
+            if (!r.strs.empty())
+                k.typed = r.strs[0];
+            kind = (k.first == L'\r' || k.keysym == XK_Return) ? &times.enter : &times.key;
+            latencyInput();
+            open = handleKey(R, k);
+            break;
+        }
+        case 'B':
+            latencyInput();
+            handleButton(R, (int)num(0), (int)num(1), (unsigned)num(2));
+            kind = &times.button;
+            break;
+        case 'P':
+            navbarHover(R, (int)num(0), (int)num(1));
+            kind = &times.pointer;
+            break;
+        case 'V':
+        case 'W':
+        {
+            tabState *P = tabById((int)num(0));
+            if (r.tag == 'V' && P && !r.strs.empty())
+                insertPasteChunk(*P, r.strs[0]);
+            else if (r.tag == 'W')
+                finishPaste(P);
+            if (P && P == activeTab())
+                makeScreen(R, *P);
+            kind = &times.paste;
+            break;
+        }
+        case 'M':
+        {
+            {
+                lock_guard<mutex> lk(mwQueueMutex);
+                mwQueue.push({r.strs.empty() ? string() : r.strs[0], (int)num(0)});
+            }
+            serviceTabs(R, true);
+            kind = &times.output;
+            break;
+        }
+        case 'F':
+            postFrame((int)num(0), r.strs);
+            serviceTabs(R, true);
+            kind = &times.frame;
+            break;
+        default:
+            continue;
+        }
+        R.flush();
+        sync();
+        latencyFlushed();
+        kind->push_back(chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+        if (!open)
+            break; // the last tab was closed
+    }
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - started).count();
+    replaying = false;
+
+    size_t events = times.key.size() + times.enter.size() + times.button.size() + times.pointer.size() +
+                    times.resize.size() + times.paste.size() + times.output.size() + times.frame.size();
+    char head[160];
+    snprintf(head, sizeof(head), "replay: %s: %zu events in %.2f ms (%.0f events/s)", path.c_str(), events,
+             wall * 1e3, wall > 0 ? events / wall : 0.0);
+    out << head << "\n";
+    replayReportLine(out, "key", times.key);
+    replayReportLine(out, "Return", times.enter);
+    replayReportLine(out, "button", times.button);
+    replayReportLine(out, "pointer", times.pointer);
+    replayReportLine(out, "resize", times.resize);
+    replayReportLine(out, "paste", times.paste);
+    replayReportLine(out, "output", times.output);
+    replayReportLine(out, "frame", times.frame);
+    if (replayDiverged || strayOutputs)
+        out << "  diverged: " << replayDiverged << " command(s) without matching output, " << strayOutputs
+            << " unused output(s)\n";
+    return true;
+}
@@ -0,0 +1,10 @@
+#pragma once
+#include "render.h"
+
+//  Session replay (replay.cpp)
+
+// Replay the file at path; resize(w, h) resizes the drawing surface before
+// the terminal is told, sync() waits until drawing is done. False (with a
+// message on out) if the file cannot be replayed.
+bool replaySession(renderer &R, const string &path, const function<void(int, int)> &resize,
+                   const function<void()> &sync, ostream &out);
@@ -1,164 +1,209 @@
-#include "headers.cpp"
-#include "exec.cpp"
+#include "run.h"
+#include "core.h"
+#include "exec.h"
+#include "find.h"
+#include "history.h"
+#include "jobs.h"
+#include "record.h"
+#include "replay.h"
+#include "snapshot.h"
+#include "counters.h"
+#include "termstat.h"
+#include "trace.h"
+
+static const long PASTE_CHUNK_LONGS = 1 << 18; // 1 MiB per XGetWindowProperty
+static const auto PASTE_REPAINT = chrono::milliseconds(100);
+
+// Read the whole PASTE_BUFFER property in bounded requests, then delete it
+// (for INCR that deletion is what asks the owner for the next chunk).
+static bool readPasteProperty(Window win, string &out, Atom &type)
+{
+    long offset = 0;
+    while (true)
+    {
+        int format = 0;
+        unsigned long nitems = 0, after = 0;
+        unsigned char *data = nullptr;
+        if (XGetWindowProperty(disp, win, atomPasteBuffer, offset, PASTE_CHUNK_LONGS, False, AnyPropertyType,
+                               &type, &format, &nitems, &after, &data) != Success)
+            return false;
+        if (data)
+        {
+            size_t n = (format == 8) ? nitems : 0; // text is always 8-bit
+            out.append((char *)data, n);
+            offset += (long)(n / 4);
+            XFree(data);
+        }
+        if (after == 0 || nitems == 0)
+            break;
+    }
+    XDeleteProperty(disp, win, atomPasteBuffer);
+    return true;
+}
+
+// Trace label of an X event.
+static const char *xEventName(int type)
+{
+    switch (type)
+    {
+    case KeyPress: return "KeyPress";
+    case ButtonPress: return "ButtonPress";
+    case MotionNotify: return "MotionNotify";
+    case LeaveNotify: return "LeaveNotify";
+    case Expose: return "Expose";
+    case ConfigureNotify: return "ConfigureNotify";
+    case MapNotify: return "MapNotify";
+    case UnmapNotify: return "UnmapNotify";
+    case VisibilityNotify: return "VisibilityNotify";
+    case FocusIn: return "FocusIn";
+    case FocusOut: return "FocusOut";
+    case SelectionNotify: return "SelectionNotify";
+    case PropertyNotify: return "PropertyNotify";
+    default: return "X event";
+    }
+}
 
 void run(Window win)
 {
+    traceThreadName("event loop");
     // font + gc
-    XFontStruct *font = XLoadQueryFont(disp, "8x16");
-
+    textFont *font = openTextFont(disp, scr, win);
     if (!font)
-        font = XLoadQueryFont(disp, "fixed");
+        errx(1, "Cant open a monospace font");
+    selectRenderer(font, win, getenv("SHRETERM_RENDERER"));
     GC gc = XCreateGC(disp, win, 0, nullptr);
-    XSetFont(disp, gc, font->fid);
     XSetForeground(disp, gc, WhitePixel(disp, scr));
+    xRenderer R(win, gc, font);
+    internAtoms();
 
-    // XIM/XIC
-    XIM xim = XOpenIM(disp, nullptr, nullptr, nullptr);
-    if (!xim)
-        std::cerr << "XOpenIM failed — continuing without input method\n";
+    // XIM/XIC: opened once the first frame is up (connecting to an input
+    // method can be slow); keys before that are looked up as Latin-1
+    XIM xim = nullptr;
     XIC xic = nullptr;
-    if (xim)
+    bool imPending = true;
+
+    XMapWindow(disp, win);
+
+    // the tabs of the last session, else one tab at / (which is also where
+    // recording and replay start)
+    bool persist = !getenv("SHRETERM_RECORD") && !getenv("SHRETERM_REPLAY");
+    if (!(persist && snapshotRestore()))
+        addTab("/");
+
+    // SHRETERM_REPLAY=FILE: drive the window from a recording, report and quit
+    if (const char *replayPath = getenv("SHRETERM_REPLAY"))
     {
-        xic = XCreateIC(xim, XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
-                        XNClientWindow, win, XNFocusWindow, win, nullptr);
-        if (!xic)
-            std::cerr << "XCreateIC failed — continuing without input context\n";
+        XEvent event;
+        do
+            XNextEvent(disp, &event);
+        while (event.type != Expose);
+        lock_guard<mutex> findLock(findMutex);
+        bool ok = replaySession(
+            R, replayPath, [&](int w, int h) { XResizeWindow(disp, win, (unsigned)max(1, w), (unsigned)max(1, h)); },
+            [] { XSync(disp, False); }, cout);
+        if (!ok)
+            exit(1);
+        return;
     }
+    // SHRETERM_RECORD=FILE: record the session for replay
+    if (const char *recordPath = getenv("SHRETERM_RECORD"))
+    {
+        awaitHistory(); // the recording starts with it
+        if (recordBegin(recordPath, inputs))
+            recordEvent('S', {winGeom.width, winGeom.height});
+        else
+            cerr << "cannot record to " << recordPath << "\n";
+    }
+    if (persist)
+        startSnapshots();
 
-    XMapWindow(disp, win);
+    // Nothing is drawn while the window is unmapped or fully covered, and the
+    // cursor only blinks while we have focus; an idle hidden window sleeps.
+    bool winVisible = true;
+    bool winFocused = true;
+
+    // SHRETERM_X11_AUDIT: report each loop iteration that waited on the server
+    unsigned long auditFrame = 0;
+    unsigned long auditSeen = x11RoundTrips();
+    int auditEvent = 0; // last event handled in this iteration
 
-    // initial tab
-    addTab("/");
+    // Held for everything done between two polls; the scrollback find
+    // scanner (find.cpp) only gets it while we sleep.
+    unique_lock<mutex> findLock(findMutex);
+
+    // anything handled since the last snapshot check
+    bool loopActive = true;
 
     // event loop
     while (true)
     {
         while (XPending(disp) > 0)
         {
+            loopActive = true;
             XEvent event;
             XNextEvent(disp, &event);
+            TRACE_SCOPE(xEventName(event.type));
+            auditEvent = event.type;
+            if (event.type == KeyPress || event.type == ButtonPress)
+                latencyInput();
 
             if (event.type == Expose)
             {
-                XWindowAttributes wa;
-                XGetWindowAttributes(disp, win, &wa);
-                // draw navbar and tabs
-                makeNavBar(win, gc, wa.width);
-                auto tpos = makeTabs(win, gc, font);
-                // draw active tab content
-                if (tabActive >= 0 && tabActive < (int)tabs.size())
-                    makeScreen(win, gc, font, tabs[tabActive]);
+                // one redraw per batch of exposed rectangles
+                if (event.xexpose.count > 0)
+                    continue;
+                redrawAll(R);
             }
-            else if (event.type == ConfigureNotify)
+            else if (event.type == MapNotify || event.type == UnmapNotify)
             {
-                // window resized: redraw all
-                XWindowAttributes wa;
-                XGetWindowAttributes(disp, win, &wa);
-                makeNavBar(win, gc, wa.width);
-                auto tpos = makeTabs(win, gc, font);
-                if (tabActive >= 0 && tabActive < (int)tabs.size())
-                    makeScreen(win, gc, font, tabs[tabActive]);
+                // mapping back in is followed by Expose, which redraws
+                winVisible = (event.type == MapNotify);
+                continue;
             }
-            else if (event.type == ButtonPress)
+            else if (event.type == VisibilityNotify)
             {
-                // navbar test first
-                XWindowAttributes wa;
-                XGetWindowAttributes(disp, win, &wa);
-                auto tpos = makeTabs(win, gc, font);
-
-                int tabIdx = -1;
-                int hit = navbarHit(event.xbutton.x, event.xbutton.y, tpos, &tabIdx);
-
-                if (hit == -2) // "+" clicked
-                {
-                    addTab("/");
-                    makeNavBar(win, gc, wa.width);
-                    tpos = makeTabs(win, gc, font);
-                    makeScreen(win, gc, font, tabs[tabActive]);
-                    continue;
-                }
-                else if (hit == -3 && tabIdx >= 0) // "×" close clicked
+                winVisible = (event.xvisibility.state != VisibilityFullyObscured);
+                continue;
+            }
+            else if (event.type == FocusIn || event.type == FocusOut)
+            {
+                winFocused = (event.type == FocusIn);
+                // leave a steady cursor behind while unfocused
+                if (!winFocused && tabActive >= 0 && tabActive < (int)tabs.size() && !tabs[tabActive].dispCursor)
                 {
-                    if (tabIdx < (int)tabs.size())
-                    {
-                        tabs.erase(tabs.begin() + tabIdx);
-                        if (tabActive >= (int)tabs.size())
-                            tabActive = (int)tabs.size() - 1;
-                        makeNavBar(win, gc, wa.width);
-                        tpos = makeTabs(win, gc, font);
-                        if (!tabs.empty())
-                            makeScreen(win, gc, font, tabs[tabActive]);
-                    }
-                    continue;
+                    tabs[tabActive].dispCursor = true;
+                    if (winVisible)
+                        makeScreen(R, tabs[tabActive]);
                 }
-                else if (hit >= 0) // clicked on tab
-                {
-                    if (hit < (int)tabs.size())
-                        tabActive = hit;
-                    makeNavBar(win, gc, wa.width);
-                    tpos = makeTabs(win, gc, font);
-                    makeScreen(win, gc, font, tabs[tabActive]);
+                continue;
+            }
+            else if (event.type == ConfigureNotify)
+            {
+                // moves and restacking need no redraw
+                if (event.xconfigure.width == winGeom.width && event.xconfigure.height == winGeom.height)
                     continue;
-                }
-
-                // content area events (scroll)
-                if (tabActive >= 0 && tabActive < (int)tabs.size())
-                {
-                    tabState &T = tabs[tabActive];
-
-                    int lineHeight = font->ascent + font->descent;
-                    int seeRows = max(1, (wa.height - (NAVBAR_H + 30)) / lineHeight);
-
-                    if (event.xbutton.button == Button4)
-                    { // wheel up
-                        T.scrlOffset = max(0, T.scrlOffset - SCROLL_STEP);
-                        T.userScrolled = true;
-                        makeScreen(win, gc, font, T);
-                    }
-                    else if (event.xbutton.button == Button5)
-                    { // wheel down
-                        int totalDisplayLines = makeScreen(win, gc, font, T);
-                        T.scrlOffset = min(max(0, totalDisplayLines - seeRows),
-                                             T.scrlOffset + SCROLL_STEP);
-                        if (T.scrlOffset >= max(0, totalDisplayLines - seeRows))
-                            T.userScrolled = false;
-                        makeScreen(win, gc, font, T);
-                    }
-                }
+                recordEvent('S', {event.xconfigure.width, event.xconfigure.height});
+                handleResize(R, event.xconfigure.width, event.xconfigure.height);
+            }
+            else if (event.type == ButtonPress)
+            {
+                recordEvent('B', {event.xbutton.x, event.xbutton.y, event.xbutton.button});
+                handleButton(R, event.xbutton.x, event.xbutton.y, event.xbutton.button);
             }
             else if (event.type == MotionNotify)
             {
-                howerXClose = -1;
-                howerPlusTab = false;
-
-                int mx = event.xmotion.x;
-
-                auto tpos = makeTabs(win, gc, font); // or cache it globally
-
-                for (size_t i = 0; i < tpos.size(); ++i)
-                {
-                    if (tpos[i].isPlus)
-                    {
-                        if (mx >= tpos[i].x && mx <= tpos[i].x + tpos[i].w)
-                            howerPlusTab = true;
-                    }
-                    else
-                    {
-                        if (mx >= tpos[i].xClose && mx <= tpos[i].xClose + tpos[i].wClose)
-                            howerXClose = i;
-                    }
-                }
-
-                makeTabs(win, gc, font); // redraw with hover state
+                // only the tab whose hover highlight changes is repainted
+                recordEvent('P', {event.xmotion.x, event.xmotion.y});
+                navbarHover(R, event.xmotion.x, event.xmotion.y);
+            }
+            else if (event.type == LeaveNotify)
+            {
+                recordEvent('P', {-1, -1});
+                navbarHover(R, -1, -1);
             }
 
             else if (event.type == KeyPress)
             {
-                if (!(tabActive >= 0 && tabActive < (int)tabs.size()))
-                    continue;
-
-                tabState &T = tabs[tabActive];
-
                 // input lookup (wide)
                 wchar_t wbuf[32];
                 KeySym keysym = 0;
@@ -168,658 +213,110 @@ void run(Window win)
                     len = XwcLookupString(xic, &event.xkey, wbuf, 32, &keysym, &status);
                 else
                 {
-                    len = 0;
-                    keysym = event.xkey.keycode;
-                }
-
-                // metrics
-                XWindowAttributes wa;
-                XGetWindowAttributes(disp, win, &wa);
-                int lineHeight = font->ascent + font->descent;
-                int seeRows = max(1, (wa.height - (NAVBAR_H + 30)) / lineHeight);
-
-                auto remakeScreenBuf = [&]()
-                {
-                    while (!T.displayBuffer.empty() && T.displayBuffer.back().rfind("shre@Term:", 0) != 0)
-                        T.displayBuffer.pop_back();
-                    if (!T.displayBuffer.empty())
-                        T.displayBuffer.pop_back();
-
-                    string sdisp = editPWD(T.cwd);
-                    string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-
-                    vector<string> parts;
-                    size_t last = 0, p;
-                    while ((p = T.input.find('\n', last)) != string::npos)
-                    {
-                        parts.push_back(T.input.substr(last, p - last));
-                        last = p + 1;
-                    }
-                    parts.push_back(T.input.substr(last));
-
-                    if (parts.empty())
-                    {
-                        T.displayBuffer.push_back(prompt);
-                        return;
-                    }
-
-                    for (size_t i = 0; i < parts.size(); ++i)
-                    {
-                        if (i == 0)
-                            T.displayBuffer.push_back(prompt + parts[i]);
-                        else
-                            T.displayBuffer.push_back(parts[i]);
-                    }
-                };
-
-                // Escape: exit app
-                if (keysym == XK_Escape)
-                {
-                    // soft-exit: close current tab if >1, else exit
-                    if (tabs.size() > 1)
-                    {
-                        tabs.erase(tabs.begin() + tabActive);
-                        if (tabActive >= (int)tabs.size())
-                            tabActive = (int)tabs.size() - 1;
-                        makeNavBar(win, gc, wa.width);
-                        auto tpos = makeTabs(win, gc, font);
-                        if (!tabs.empty())
-                            makeScreen(win, gc, font, tabs[tabActive]);
-                        continue;
-                    }
-                    else
-                    {
-                        return;
-                    }
+                    char cbuf[32];
+                    len = XLookupString(&event.xkey, cbuf, sizeof(cbuf), &keysym, nullptr);
+                    for (int i = 0; i < len; ++i)
+                        wbuf[i] = (unsigned char)cbuf[i];
+                    status = (len > 0) ? XLookupBoth : XLookupKeySym;
                 }
 
-                // PageUp/Down, Home/End
-                if (keysym == XK_Page_Up)
-                {
-                    T.scrlOffset = max(0, T.scrlOffset - SCROLL_STEP * 5);
-                    T.userScrolled = true;
-                    makeScreen(win, gc, font, T);
-                    continue;
-                }
-                else if (keysym == XK_Page_Down)
+                keyInput k;
+                k.keysym = keysym;
+                k.state = event.xkey.state;
+                k.chars = (status == XLookupChars || status == XLookupBoth) && len > 0;
+                if (k.chars)
                 {
-                    int totalDisplayLines = makeScreen(win, gc, font, T);
-                    T.scrlOffset = min(max(0, totalDisplayLines - seeRows), T.scrlOffset + SCROLL_STEP * 5);
-                    if (T.scrlOffset >= max(0, totalDisplayLines - seeRows))
-                        T.userScrolled = false;
-                    makeScreen(win, gc, font, T);
-                    continue;
+                    k.first = wbuf[0];
+                    // typed text as UTF-8, control characters left out
+                    for (int i = 0; i < len; ++i)
+                        if (wbuf[i] >= 32 && wbuf[i] != 127)
+                            appendUtf8(k.typed, (uint32_t)wbuf[i]);
                 }
-                else if (keysym == XK_Home && (event.xkey.state & ControlMask))
-                {
-                    T.scrlOffset = 0;
-                    T.userScrolled = true;
-                    makeScreen(win, gc, font, T);
-                    continue;
-                }
-                else if (keysym == XK_End && (event.xkey.state & ControlMask))
-                {
-                    int totalDisplayLines = makeScreen(win, gc, font, T);
-                    T.scrlOffset = max(0, totalDisplayLines - seeRows);
-                    T.userScrolled = false;
-                    makeScreen(win, gc, font, T);
+                if (recording())
+                    recordEvent('K', {(long long)k.keysym, k.state, k.first}, {k.typed});
+                if (!handleKey(R, k))
+                    return;
+            }
+            else if (event.type == SelectionNotify)
+            {
+                if (event.xselection.selection != atomClipboard || !paste.active || paste.incr)
                     continue;
-                }
+                tabState *P = tabById(paste.tabId);
 
-                // History up/down
-                if (keysym == XK_Up)
+                // no UTF8_STRING from the owner: ask once more for plain STRING
+                if (event.xselection.property == None)
                 {
-                    if (T.searchFlag || T.recommFlag)
-                    { /* ignore */
-                    }
-                    else if (!inputs.empty())
+                    if (!paste.triedString)
                     {
-                        T.multLineFlag = false;
-                        if (T.inpIdx > 0)
-                            T.inpIdx--;
-                        else
-                            T.inpIdx = 0;
-
-                        T.input = inputs[T.inpIdx];
-                        for (char c : T.input)
-                            if (c == '"')
-                                T.multLineFlag = !T.multLineFlag;
-                        T.currentCursorPosition = (int)T.input.size();
-                        remakeScreenBuf();
-                        makeScreen(win, gc, font, T);
+                        paste.triedString = true;
+                        XConvertSelection(disp, atomClipboard, XA_STRING, atomPasteBuffer, win, CurrentTime);
                     }
-                    continue;
-                }
-                if (keysym == XK_Down)
-                {
-                    if (T.searchFlag || T.recommFlag)
-                    { /* ignore */
-                    }
-                    else if (!inputs.empty())
-                    {
-                        T.multLineFlag = false;
-                        if (T.inpIdx < (int)inputs.size() - 1)
-                        {
-                            T.inpIdx++;
-                            T.input = inputs[T.inpIdx];
-                        }
-                        else
-                        {
-                            T.inpIdx = (int)inputs.size();
-                            T.input.clear();
-                        }
-                        for (char c : T.input)
-                            if (c == '"')
-                                T.multLineFlag = !T.multLineFlag;
-                        T.currentCursorPosition = (int)T.input.size();
-                        remakeScreenBuf();
-                        makeScreen(win, gc, font, T);
-                    }
-                    continue;
-                }
-
-                // Left/Right
-                if (keysym == XK_Left)
-                {
-                    if (T.currentCursorPosition > 0)
-                        T.currentCursorPosition--;
-                    makeScreen(win, gc, font, T);
-                    continue;
-                }
-                if (keysym == XK_Right)
-                {
-                    if (T.currentCursorPosition < (int)T.input.size())
-                        T.currentCursorPosition++;
-                    makeScreen(win, gc, font, T);
-                    continue;
-                }
-
-                // Ctrl+V paste request
-                if ((event.xkey.state & ControlMask) && (keysym == XK_v || keysym == XK_V))
-                {
-                    XConvertSelection(disp, XInternAtom(disp, "CLIPBOARD", False),
-                                      XInternAtom(disp, "UTF8_STRING", False),
-                                      XInternAtom(disp, "PASTE_BUFFER", False),
-                                      win, CurrentTime);
-                    continue;
-                }
-
-                // Ctrl+R search
-                if ((event.xkey.state & ControlMask) && (keysym == XK_r || keysym == XK_R))
-                {
-                    T.displayBuffer.push_back("REC:Enter search term:");
-                    T.input.clear();
-                    string sdisp = editPWD(T.cwd);
-                    string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-                    T.currentCursorPosition = 0;
-                    T.searchFlag = true;
-                    makeScreen(win, gc, font, T);
-                    continue;
-                }
-
-                // Ctrl+A start
-                if ((event.xkey.state & ControlMask) && (keysym == XK_a || keysym == XK_A))
-                {
-                    if (T.searchFlag)
-                        T.currentCursorPosition = 0;
                     else
-                        T.currentCursorPosition = T.count;
-                    makeScreen(win, gc, font, T);
-                    continue;
-                }
-                // Ctrl+E end
-                if ((event.xkey.state & ControlMask) && (keysym == XK_e|| keysym == XK_E))
-                {
-                    T.currentCursorPosition = (int)T.input.size();
-                    makeScreen(win, gc, font, T);
-                    continue;
-                }
-                if ((event.xkey.state & ControlMask) && keysym == XK_Tab)
-                {
-                    if (!tabs.empty())
-                    {
-                        tabActive = (tabActive + 1) % tabs.size();
-                        makeNavBar(win, gc, wa.width);
-                        makeTabs(win, gc, font);
-                        makeScreen(win, gc, font, tabs[tabActive]);
-                    }
+                        finishPaste(P);
                     continue;
                 }
 
-                // Ctrl + Shift + Tab → previous tab
-                if ((event.xkey.state & ControlMask) && (event.xkey.state & ShiftMask) && keysym == XK_ISO_Left_Tab)
-                {
-                    if (!tabs.empty())
-                    {
-                        tabActive = (tabActive - 1 + tabs.size()) % tabs.size();
-                        makeNavBar(win, gc, wa.width);
-                        makeTabs(win, gc, font);
-                        makeScreen(win, gc, font, tabs[tabActive]);
-                    }
-                    continue;
-                }
-                // Tab completion (your logic)
-                if (keysym == XK_Tab)
+                string clipText;
+                Atom type = None;
+                if (!readPasteProperty(win, clipText, type))
                 {
-                    if (!T.input.empty())
-                    {
-                        T.recommFlag = true;
-                        T.query = extractQuery(T.input);
-                        if (T.query == T.input && T.query.rfind("./", 0) == 0)
-                            T.query = T.query.substr(2);
-                        T.forRec = T.input;
-
-                        // list directory allCandidates under tab cwd
-                        auto outputs = execInDir("ls", T.cwd);
-                        vector<string> allCandidates;
-                        for (auto &l : outputs)
-                            if (!l.empty() && l.rfind("ERROR:", 0) != 0)
-                                allCandidates.push_back(l);
-
-                        T.recs = getRecommendations(T.query, allCandidates);
-                        if (T.recs.empty())
-                        {
-                            T.recommFlag = false;
-                        }
-                        else if (T.recs.size() == 1)
-                        {
-                            T.input += T.recs[0].substr(T.query.size());
-                            // update last prompt line
-                            if (!T.displayBuffer.empty())
-                                T.displayBuffer.back() += T.recs[0].substr(T.query.size());
-                            T.recommFlag = false;
-                            T.currentCursorPosition = (int)T.input.size();
-                        }
-                        else
-                        {
-                            for (size_t i = 0; i < T.recs.size(); i++)
-                                T.showRec += to_string(i + 1) + ". " + T.recs[i] + "  ";
-                            T.displayBuffer.push_back("REC:" + T.showRec);
-                            T.displayBuffer.push_back("REC:Choose from above options:");
-                            T.input.clear();
-                            T.currentCursorPosition = 0;
-                            T.showRec.clear();
-                        }
-                        makeScreen(win, gc, font, T);
-                    }
+                    finishPaste(P);
                     continue;
                 }
-                // Ctrl + C handling for multiWatch stop
-                if ((event.xkey.state & ControlMask) && (keysym == XK_c || keysym == XK_C))
+                if (type == atomIncr)
                 {
-                    // Request stop from execute.cpp (async-safe)
-                        getSigint();
-
-                        // Give watcher thread a short timeout to finish its cleanup & restore buffer.
-                        // Poll mwDone (set by execute.cpp when multiWatch ends).
-                        for (int i = 0; i < 10; ++i)
-                        {
-                            if (mwDone.load())
-                                break;
-                            this_thread::sleep_for(chrono::milliseconds(50));
-                        }
-
-                        // Reset stop flags so the next command can run normally.
-                        mwStopReq.store(false);
-                        mwDone.store(false);
-                        cmdRunning.store(false);
-
-                        // Append ^C and prompt to screenBuffer and redraw
-                        tabState &T2 = tabs[tabActive];
-                        T2.displayBuffer.push_back("^C");
-
-                        string sdisp = editPWD(T2.cwd);
-                        string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-                        T2.displayBuffer.push_back(prompt);
-                        T2.input.clear();
-                        T2.currentCursorPosition = 0;
-
-                        makeScreen(win, gc, font, T2);
-                        
+                    // deleting the property (done above) starts the transfer
+                    paste.incr = true;
                     continue;
                 }
 
-                // Printable handling via wbuf
-                if ((status == XLookupChars || status == XLookupBoth) && len > 0)
+                if (P)
                 {
-                    // ENTER
-                    if (wbuf[0] == L'\r' || wbuf[0] == L'\n')
-                    {
-                        if (T.recommFlag)
-                        {
-                            int recIdx = min(getRecIdx(T.input), (int)T.recs.size()) - 1;
-                            if (recIdx < 0)
-                                recIdx = 0;
-                            string rec = T.recs[recIdx];
-                            T.input = T.forRec + rec.substr(T.query.size());
-
-                            string sdisp = editPWD(T.cwd);
-                            string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-
-                            // remove the three pushed lines
-                            if (!T.displayBuffer.empty())
-                            {
-                                T.displayBuffer.pop_back();
-                            }
-                            if (!T.displayBuffer.empty())
-                            {
-                                T.displayBuffer.pop_back();
-                            }
-                            if (!T.displayBuffer.empty())
-                            {
-                                T.displayBuffer.pop_back();
-                            }
-                            T.displayBuffer.push_back(prompt + T.input);
-                            T.currentCursorPosition = (int)T.input.size();
-                            T.recommFlag = false;
-                            continue;
-                        }
-
-                        if (T.searchFlag)
-                        {
-                            string search_res = searchFromHistory(T.input);
-                            T.input.clear();
-                            string sdisp = editPWD(T.cwd);
-                            string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-                            if (search_res != "No match for search term in history")
-                            {
-                                T.input = search_res;
-                                T.multLineFlag = false;
-                                for (char c : T.input)
-                                    if (c == '"')
-                                        T.multLineFlag = !T.multLineFlag;
-                                T.displayBuffer.push_back(prompt + T.input);
-                                T.currentCursorPosition = (int)T.input.size();
-                            }
-                            else
-                            {
-                                T.displayBuffer.push_back(search_res);
-                                T.displayBuffer.push_back(prompt + T.input);
-                                T.currentCursorPosition = 0;
-                            }
-                            T.searchFlag = false;
-                            continue;
-                        }
-
-                        if (T.multLineFlag)
-                        {
-                            T.input.insert(T.input.begin() + T.currentCursorPosition, '\n');
-                            T.currentCursorPosition++;
-                            T.count = (int)T.input.size();
-                            remakeScreenBuf();
-                            makeScreen(win, gc, font, T);
-                            continue;
-                        }
-                        else
-                        {
-                            if (!T.input.empty())
-                            {
-                                if (inputs.empty() || inputs.back() != T.input)
-                                {
-                                    storeHistory(T.input);
-                                    inputs.push_back(T.input);
-                                }
-                            }
-                            T.count = 0;
-                            T.inpIdx = (int)inputs.size();
-
-                            auto trimLocal = [](const string &s) -> string
-                            {
-                                size_t a = 0, b = s.size();
-                                while (a < b && isspace((unsigned char)s[a]))
-                                    ++a;
-                                while (b > a && isspace((unsigned char)s[b - 1]))
-                                    --b;
-                                return s.substr(a, b - a);
-                            };
-                            string stripped = trimLocal(T.input);
-
-                            if (stripped == "history")
-                            {
-                                ifstream in(historyPath);
-                                if (!in)
-                                {
-                                    cerr << "Error: cannot open file\n";
-                                }
-                                else
-                                {
-                                    string line;
-                                    while (getline(in, line))
-                                        T.displayBuffer.push_back(line);
-                                    in.close();
-                                }
-                            }
-                            if (stripped == "clear")
-                            {
-                                T.displayBuffer.clear();
-                                string sdisp = editPWD(T.cwd);
-                                string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-                                T.displayBuffer.push_back(prompt);
-                                T.input.clear();
-                                T.currentCursorPosition = 0;
-                                T.multLineFlag = false;
-                                int totalDisplayLines = makeScreen(win, gc, font, T);
-                                T.scrlOffset = max(0, totalDisplayLines - seeRows);
-                                T.userScrolled = false;
-                                makeScreen(win, gc, font, T);
-                                continue;
-                            }
-                            if (stripped.rfind("multiWatch", 0) == 0)
-                                {
-                                    size_t start = T.input.find('[');
-                                    size_t end = T.input.find(']');
-                                    if (start != string::npos && end != string::npos && end > start)
-                                    {
-                                        string inside = T.input.substr(start + 1, end - start - 1);
-                                        vector<string> cmds;
-                                        regex r("\"([^\"]+)\"");
-                                        smatch m;
-                                        string::const_iterator s(inside.cbegin());
-                                        while (regex_search(s, inside.cend(), m, r))
-                                        {
-                                            cmds.push_back(m[1]);
-                                            s = m.suffix().first;
-                                        }
-
-                                        if (cmds.empty())
-                                        {
-                                            T.displayBuffer.push_back("multiWatch: No valid commands found.");
-                                        }
-                                        else
-                                        {
-                                            // Copy old screen buffer safely
-                                            vector<string> oldBuffer;
-                                            oldBuffer.insert(oldBuffer.end(), T.displayBuffer.begin(), T.displayBuffer.end());
-
-                                            // Clear screen for watch mode
-                                            T.displayBuffer.clear();
-                                            T.displayBuffer.push_back("multiWatch — starting...");
-
-                                            // Mark multiwatch active
-                                            mwStopReq.store(false);
-                                            mwDone.store(false);
-
-                                            // Pass oldBuffer to thread so it can restore later
-                                            thread([cmds, tab_index = tabActive, oldBuffer]()
-                                                   { multiWatchThreaded_using_pipes(cmds, tab_index, oldBuffer); })
-                                                .detach();
-                                        }
-                                    }
-                                    else
-                                    {
-                                        T.displayBuffer.push_back("Usage: multiWatch [\"cmd1\", \"cmd2\", ...]");
-                                    }
-
-                                    // Clear input for next command
-                                    T.input.clear();
-                                    T.currentCursorPosition = 0;
-                                    break;
-                                }
-                            // execute in tab cwd
-                            vector<string> outputs = execInDir(T.input, T.cwd);
-                            T.input.clear();
-                            T.currentCursorPosition = 0;
-
-                            // Check if this command is multiWatch
-                            bool isMultiWatch = (T.input.find("multiWatch") != string::npos);
-
-                            // Push command output lines
-                            for (const auto &line : outputs)
-                                T.displayBuffer.push_back(line);
-
-                            // Only show prompt if NOT multiWatch
-                            if (!isMultiWatch)
-                            {
-                                string sdisp = editPWD(T.cwd);
-                                string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-                                T.displayBuffer.push_back(prompt);
-                            }
-
-                            int totalDisplayLines = makeScreen(win, gc, font, T);
-                            if (!T.userScrolled)
-                            {
-                                T.scrlOffset = max(0, totalDisplayLines - seeRows);
-                                makeScreen(win, gc, font, T);
-                            }
-                            continue;
-                        }
-                    }
-
-                    // BACKSPACE
-                    if (wbuf[0] == 8 || wbuf[0] == 127)
-                    {
-                        if ((T.searchFlag || T.recommFlag) && !T.input.empty())
-                        {
-                            string curr = T.displayBuffer.back();
-                            T.displayBuffer.pop_back();
-                            T.input.erase(T.input.begin() + T.currentCursorPosition - 1);
-                            T.displayBuffer.push_back(curr.substr(0, curr.size() - 1));
-                            T.currentCursorPosition--;
-                            continue;
-                        }
-
-                        if (T.currentCursorPosition > 0)
-                        {
-                            if (T.input[T.currentCursorPosition - 1] == '"')
-                                T.multLineFlag = !T.multLineFlag;
-                            T.input.erase(T.input.begin() + T.currentCursorPosition - 1);
-                            T.currentCursorPosition--;
-                            remakeScreenBuf();
-                            makeScreen(win, gc, font, T);
-                        }
-                        continue;
-                    }
-
-                    // Regular printable char
-                    char ch = (char)wbuf[0];
-                    if (T.recommFlag)
-                    {
-                        T.input.insert(T.input.begin() + T.currentCursorPosition, ch);
-                        T.displayBuffer.back() += ch;
-                        T.currentCursorPosition++;
-                        continue;
-                    }
-                    if (T.searchFlag)
-                    {
-                        T.input.insert(T.input.begin() + T.currentCursorPosition, ch);
-                        T.displayBuffer.back() += ch;
-                        T.currentCursorPosition++;
-                        continue;
-                    }
-                    if (isprint((unsigned char)ch) || ch == '\t')
-                    {
-                        if (ch == '"')
-                            T.multLineFlag = !T.multLineFlag;
-                        T.input.insert(T.input.begin() + T.currentCursorPosition, ch);
-                        T.currentCursorPosition++;
-                        remakeScreenBuf();
-                        makeScreen(win, gc, font, T);
-                        continue;
-                    }
+                    insertPasteChunk(*P, std::move(clipText));
+                    finishPaste(P);
+                    if (P == activeTab())
+                        makeScreen(R, *P);
                 }
+                else
+                    finishPaste(nullptr);
             }
-            else if (event.type == SelectionNotify)
+            else if (event.type == PropertyNotify)
             {
-                if (!(tabActive >= 0 && tabActive < (int)tabs.size()))
+                // next INCR chunk; a zero-length chunk ends the transfer
+                if (!paste.incr || event.xproperty.atom != atomPasteBuffer || event.xproperty.state != PropertyNewValue)
                     continue;
-                tabState &T = tabs[tabActive];
-
-                if (event.xselection.selection == XInternAtom(disp, "CLIPBOARD", False))
+                tabState *P = tabById(paste.tabId);
+                string chunk;
+                Atom type = None;
+                bool ok = readPasteProperty(win, chunk, type);
+                if (!ok || chunk.empty())
                 {
-                    Atom type;
-                    int format;
-                    unsigned long nitems, bytes_after;
-                    unsigned char *data = nullptr;
-
-                    XGetWindowProperty(disp, win,
-                                       XInternAtom(disp, "PASTE_BUFFER", False),
-                                       0, (~0L), True, AnyPropertyType,
-                                       &type, &format, &nitems, &bytes_after, &data);
-
-                    if (data)
-                    {
-                        std::string clipText((char *)data, nitems);
-                        XFree(data);
-
-                        std::istringstream ss(clipText);
-                        std::string line;
-                        bool first = true;
-
-                        while (std::getline(ss, line))
-                        {
-                            if (first)
-                            {
-                                if (!T.displayBuffer.empty())
-                                    T.displayBuffer.back() += line;
-                                T.input += line;
-                                first = false;
-                            }
-                            else
-                            {
-                                T.displayBuffer.push_back(line);
-                                T.input += '\n';
-                                T.input += line;
-                            }
-                        }
-                        T.currentCursorPosition = (int)T.input.size();
-                        makeScreen(win, gc, font, T);
-                    }
-                }
-            }
-        } // while XPending
-        // drain multiWatch queue
-        {
-            std::lock_guard<std::mutex> lk(mwQueueMutex);
-            while (!mwQueue.empty())
-            {
-                auto msg = mwQueue.front();
-                mwQueue.pop();
-
-                if (msg.text == "__MULTIWATCH_DONE__")
-                {
-                    // MultiWatch finished now show prompt
-                    if (msg.tabIdx >= 0 && msg.tabIdx < (int)tabs.size())
-                    {
-                        tabState &T = tabs[msg.tabIdx];
-                        string sdisp = editPWD(T.cwd);
-                        string prompt = (sdisp == "/") ? ("shre@Term:" + sdisp + "$ ") : ("shre@Term:~" + sdisp + "$ ");
-                        T.displayBuffer.push_back(prompt);
-                        makeScreen(win, gc, font, T);
-                    }
+                    finishPaste(P);
+                    if (P && P == activeTab())
+                        makeScreen(R, *P);
                     continue;
                 }
+                if (!P)
+                    continue; // tab closed: keep draining so the owner finishes
+
+                insertPasteChunk(*P, std::move(chunk));
 
-                if (msg.tabIdx >= 0 && msg.tabIdx < (int)tabs.size())
+                // repaint at a bounded rate while chunks stream in
+                auto now = chrono::steady_clock::now();
+                if (now - paste.lastPaint >= PASTE_REPAINT)
                 {
-                    tabs[msg.tabIdx].displayBuffer.push_back(msg.text);
-                    if (msg.tabIdx == tabActive)
-                        makeScreen(win, gc, font, tabs[tabActive]);
+                    paste.lastPaint = now;
+                    P->statusLine = "REC:pasting... " + to_string(paste.bytes / 1024) + " KiB";
+                    if (P == activeTab() && winVisible)
+                        makeScreen(R, *P);
                 }
             }
-        }
+        } // while XPending
+        serviceTabs(R, winVisible);
 
-        // blink active tab cursor only
-        if (tabActive >= 0 && tabActive < (int)tabs.size())
+        // blink active tab cursor only, and only while it can be seen
+        bool blinking = winVisible && winFocused && tabActive >= 0 && tabActive < (int)tabs.size();
+        if (blinking)
         {
             tabState &T = tabs[tabActive];
             auto now = chrono::steady_clock::now();
@@ -827,11 +324,95 @@ void run(Window win)
             {
                 T.dispCursor = !T.dispCursor;
                 T.lastBlink = now;
-                makeScreen(win, gc, font, T);
+                makeScreen(R, T);
+            }
+        }
+        // sleep until X input, a worker wakeup, a child state change or the next blink
+        int timeout = -1;
+        if (blinking)
+        {
+            auto sinceBlink = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - tabs[tabActive].lastBlink).count();
+            timeout = (int)max<long long>(1, 501 - sinceBlink);
+        }
+        if (jobStateChangeExpected())
+            timeout = (timeout < 0) ? 20 : min(timeout, 20);
+        // save the tabs a little after they change
+        int snapWait = snapshotTick(loopActive);
+        loopActive = false;
+        if (snapWait >= 0)
+            timeout = (timeout < 0) ? snapWait : min(timeout, snapWait);
+
+        if (x11AuditEnabled())
+        {
+            ++auditFrame;
+            unsigned long trips = x11RoundTrips();
+            if (trips != auditSeen)
+                cerr << "x11 audit: frame " << auditFrame << ": " << (trips - auditSeen)
+                     << " round-trip(s), last event type " << auditEvent << "\n";
+            auditSeen = trips;
+            auditEvent = 0;
+        }
+
+        vector<struct pollfd> waitFds;
+        waitFds.push_back({ConnectionNumber(disp), POLLIN, 0});
+        waitFds.push_back({uiWakeFd, POLLIN, 0});
+        // history that finished loading in the background is taken over here
+        if (historyLoading() && histLoadDone.load())
+            awaitHistory();
+        waitFds.push_back({historyLoading() ? -1 : histWatchFd, POLLIN, 0}); // ignored by poll() when -1
+        size_t childFrom = waitFds.size();
+        addChildWatchFds(waitFds);
+
+        {
+            TRACE_SCOPE("XFlush");
+            XFlush(disp);
+        }
+        latencyFlushed();
+        counters.xRequests = NextRequest(disp) - 1;
+        if (imPending && counters.screenCalls > 0)
+        {
+            if (!counters.startupUs)
+                counters.startupUs = usSince(processStart);
+            imPending = false;
+            xim = XOpenIM(disp, nullptr, nullptr, nullptr);
+            if (!xim)
+                std::cerr << "XOpenIM failed — continuing without input method\n";
+            else
+            {
+                xic = XCreateIC(xim, XNInputStyle, XIMPreeditNothing | XIMStatusNothing,
+                                XNClientWindow, win, XNFocusWindow, win, nullptr);
+                if (!xic)
+                    std::cerr << "XCreateIC failed — continuing without input context\n";
+            }
+        }
+        findLock.unlock();
+        traceScope pollTrace("poll");
+        int ready = (XPending(disp) == 0) ? poll(waitFds.data(), waitFds.size(), timeout) : 0;
+        pollTrace.end();
+        findUiWaiting.store(true);
+        findLock.lock();
+        findUiWaiting.store(false);
+        if (ready > 0)
+        {
+            // the history watch alone may have woken us for nothing
+            if (ready > 1 || !(waitFds[2].revents & POLLIN))
+                loopActive = true;
+            if (waitFds[1].revents & POLLIN)
+            {
+                uint64_t n;
+                if (read(uiWakeFd, &n, sizeof(n)) < 0) {}
+            }
+            // another instance appended to (or compacted) the shared history
+            if (waitFds[2].revents & POLLIN)
+            {
+                size_t before = inputs.size();
+                uint64_t reloads = histReloads;
+                if (historyChanged())
+                    followHistory(before, reloads);
             }
+            if (childWatchFired(waitFds, childFrom))
+                reapPending = true;
         }
-        // tiny sleep
-        this_thread::sleep_for(chrono::milliseconds(20));
     }
 
     if (xic)
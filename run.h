@@ -0,0 +1,6 @@
+#pragma once
+#include "headers.h"
+
+//  X11 event loop (run.cpp)
+
+void run(Window win);
@@ -0,0 +1,195 @@
+#include "sessionlog.h"
+
+//  Per-tab session logging
+//
+// Callers only queue a command with its output; a single writer thread
+// formats the records, batches them per file and writes each batch with one
+// write() call, so neither formatting nor a slow disk stalls input handling
+// or command capture.
+
+struct logRecord
+{
+    string path; // the tab's log file when the record was queued
+    time_t startedAt;
+    string cwd, cmd;
+    int status;
+    long long durationMs;
+    vector<string> output;
+};
+
+static void formatRecord(string &out, const logRecord &r)
+{
+    struct tm tmbuf;
+    localtime_r(&r.startedAt, &tmbuf);
+    char ts[64];
+    strftime(ts, sizeof(ts), "%Y-%m-%d %H:%M:%S", &tmbuf);
+
+    out += "=== ";
+    out += ts;
+    out += "  [" + r.cwd + "]  $ " + r.cmd + "\n";
+    for (auto &l : r.output)
+    {
+        out += l;
+        out += '\n';
+    }
+    out += "=== exit " + to_string(r.status) + "  (" + to_string(r.durationMs) + " ms)\n\n";
+}
+
+static mutex logMutex;
+static condition_variable logCv;
+static vector<logRecord> logQueue; // guarded by logMutex
+static size_t logQueuedBytes = 0;  // guarded by logMutex
+static bool logStop = false;       // guarded by logMutex
+static map<int, string> logPaths;  // tabId -> file, guarded by logMutex
+static thread logThread;
+
+static const size_t LOG_BATCH_BYTES = 1 << 20;
+static const auto LOG_BATCH_DELAY = chrono::milliseconds(250);
+
+static void logWriterLoop()
+{
+    map<string, int> fds; // path -> open log file
+    unique_lock<mutex> lk(logMutex);
+    while (true)
+    {
+        logCv.wait_for(lk, LOG_BATCH_DELAY, []{ return logStop || logQueuedBytes >= LOG_BATCH_BYTES; });
+        if (logQueue.empty())
+        {
+            if (logStop) break;
+            continue;
+        }
+
+        vector<logRecord> batch;
+        batch.swap(logQueue);
+        logQueuedBytes = 0;
+        lk.unlock();
+
+        // one buffer and one write() per file per batch
+        map<string, string> perFile;
+        for (auto &r : batch)
+            formatRecord(perFile[r.path], r);
+
+        for (auto &[path, data] : perFile)
+        {
+            auto open_it = fds.find(path);
+            if (open_it == fds.end())
+            {
+                int nfd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                if (nfd < 0) continue;
+                open_it = fds.emplace(path, nfd).first;
+            }
+            int fd = open_it->second;
+            const char *p = data.data();
+            size_t left = data.size();
+            while (left > 0)
+            {
+                ssize_t n = write(fd, p, left);
+                if (n < 0 && errno == EINTR) continue;
+                if (n <= 0) break;
+                p += n;
+                left -= n;
+            }
+        }
+
+        lk.lock();
+        // files no tab logs to any more are closed between batches
+        for (auto it = fds.begin(); it != fds.end();)
+        {
+            bool inUse = false;
+            for (auto &[tabId, path] : logPaths)
+                if (path == it->first) inUse = true;
+            if (!inUse)
+            {
+                close(it->second);
+                it = fds.erase(it);
+            }
+            else ++it;
+        }
+    }
+    for (auto &[path, fd] : fds)
+        close(fd);
+}
+
+// Flush everything queued and stop the writer (atexit).
+static void sessionLogShutdown()
+{
+    {
+        lock_guard<mutex> lk(logMutex);
+        logStop = true;
+    }
+    logCv.notify_all();
+    if (logThread.joinable())
+        logThread.join();
+}
+
+static void startLogWriter()
+{
+    if (logThread.joinable()) return;
+    logThread = thread(logWriterLoop);
+    atexit(sessionLogShutdown);
+}
+
+vector<string> sessionLogBuiltin(int tabId, const string &arg, const string &cwd)
+{
+    lock_guard<mutex> lk(logMutex);
+    if (arg.empty())
+    {
+        auto it = logPaths.find(tabId);
+        return {it == logPaths.end() ? "sessionlog: off" : "sessionlog: " + it->second};
+    }
+    if (arg == "off")
+    {
+        logPaths.erase(tabId);
+        return {""};
+    }
+
+    string dir;
+    if (arg == "on") dir = cwd;
+    else if (arg.rfind("on ", 0) == 0)
+    {
+        dir = arg.substr(3);
+        dir.erase(0, dir.find_first_not_of(" \t"));
+        if (!dir.empty() && dir[0] != '/') dir = cwd + "/" + dir;
+    }
+    else return {"Usage: sessionlog [on [dir] | off]"};
+
+    struct stat st{};
+    if (stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode))
+        return {"ERROR: sessionlog: not a directory: " + dir};
+
+    string path = dir + "/shreterm-" + to_string(getpid()) + "-tab" + to_string(tabId) + ".log";
+    logPaths[tabId] = path;
+    startLogWriter();
+    return {"sessionlog: " + path};
+}
+
+void sessionLogCloseTab(int tabId)
+{
+    lock_guard<mutex> lk(logMutex);
+    logPaths.erase(tabId);
+}
+
+bool sessionLogEnabled(int tabId)
+{
+    lock_guard<mutex> lk(logMutex);
+    return logPaths.count(tabId) > 0;
+}
+
+void sessionLogCommand(int tabId, time_t startedAt, const string &cwd, const string &cmd,
+                       int status, long long durationMs, vector<string> output)
+{
+    size_t bytes = cmd.size() + cwd.size() + 96;
+    for (auto &l : output) bytes += l.size() + 1;
+
+    bool full;
+    {
+        lock_guard<mutex> lk(logMutex);
+        auto it = logPaths.find(tabId);
+        if (it == logPaths.end()) return;
+        logQueuedBytes += bytes;
+        logQueue.push_back({it->second, startedAt, cwd, cmd, status, durationMs, std::move(output)});
+        full = logQueuedBytes >= LOG_BATCH_BYTES;
+    }
+    if (full)
+        logCv.notify_all();
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include "headers.h"
+
+//  Per-tab session logging (sessionlog.cpp)
+
+// sessionlog on [dir] | sessionlog off | sessionlog
+vector<string> sessionLogBuiltin(int tabId, const string &arg, const string &cwd);
+
+// Tab closed: stop logging it (already queued records are still written).
+void sessionLogCloseTab(int tabId);
+
+bool sessionLogEnabled(int tabId);
+
+// Queue one executed command; output is moved in as it is, formatting and
+// I/O happen on the writer thread.
+void sessionLogCommand(int tabId, time_t startedAt, const string &cwd, const string &cmd,
+                       int status, long long durationMs, vector<string> output);
@@ -0,0 +1,285 @@
+#include "snapshot.h"
+#include "draw.h"
+#include "history.h"
+#include "counters.h"
+#include "trace.h"
+
+//  Session snapshots
+//
+// The tabs (cwd, title, the input being edited and the tail of the
+// scrollback) are saved to snapshotPath a few seconds after they change and
+// restored when the terminal starts again. The event loop only copies that
+// state, which the tail limits keep small; a writer thread encodes it and
+// replaces the file atomically, as for the history file. Restoring maps the
+// file and reads it in one pass, so it takes time in proportion to the file,
+// which is bounded, however much scrollback the tabs once had.
+//
+// File: "SHRS", u32 version, u32 tab count, u32 active tab, then per tab the
+// cwd, title and input and a u32 line count followed by the lines (strings
+// as u32 length + bytes), then a CRC-32 of everything before it.
+
+static const char SNAP_MAGIC[4] = {'S', 'H', 'R', 'S'};
+static const uint32_t SNAP_VERSION = 1;
+static const size_t SNAP_TAIL_LINES = 5000;      // per tab
+static const size_t SNAP_TAIL_BYTES = 1 << 20;   // per tab
+static const size_t SNAP_MAX_FILE = 64u << 20;   // larger files are not restored
+static const auto SNAP_INTERVAL = chrono::seconds(3);
+
+string snapshotPath = "./shreterm_session.bin";
+
+struct tabSnapshot
+{
+    string cwd, title, input;
+    vector<string> lines;
+};
+
+static mutex snapMutex;
+static condition_variable snapCv;
+static vector<tabSnapshot> snapPending; // guarded by snapMutex
+static uint32_t snapPendingActive = 0;  // guarded by snapMutex
+static bool snapHave = false;           // guarded by snapMutex
+static bool snapStop = false;           // guarded by snapMutex
+static thread snapThread;
+
+// event loop only
+static uint64_t snapStamp = 0;    // of the tabs as last saved (or restored)
+static bool snapMaybeDirty = false;
+static chrono::steady_clock::time_point snapLastCheck;
+
+static void putString(string &out, const string &s)
+{
+    putRaw<uint32_t>(out, (uint32_t)s.size());
+    out += s;
+}
+
+static string encodeSnapshot(const vector<tabSnapshot> &saved, uint32_t active)
+{
+    string out(SNAP_MAGIC, 4);
+    putRaw<uint32_t>(out, SNAP_VERSION);
+    putRaw<uint32_t>(out, (uint32_t)saved.size());
+    putRaw<uint32_t>(out, active);
+    for (auto &s : saved)
+    {
+        putString(out, s.cwd);
+        putString(out, s.title);
+        putString(out, s.input);
+        putRaw<uint32_t>(out, (uint32_t)s.lines.size());
+        for (auto &l : s.lines)
+            putString(out, l);
+    }
+    putRaw<uint32_t>(out, crc32Of(out.data(), out.size()));
+    return out;
+}
+
+static bool decodeSnapshot(const char *data, size_t size, vector<tabSnapshot> &saved, uint32_t &active)
+{
+    if (size < 20 || memcmp(data, SNAP_MAGIC, 4) != 0 || getRaw<uint32_t>(data + 4) != SNAP_VERSION ||
+        getRaw<uint32_t>(data + size - 4) != crc32Of(data, size - 4))
+        return false;
+    const char *p = data + 8;
+    const char *end = data + size - 4;
+    bool ok = true;
+    auto u32 = [&]() -> uint32_t {
+        if (end - p < 4)
+        {
+            ok = false;
+            return 0;
+        }
+        uint32_t v = getRaw<uint32_t>(p);
+        p += 4;
+        return v;
+    };
+    auto str = [&]() -> string {
+        uint32_t n = u32();
+        if (!ok || (size_t)(end - p) < n)
+        {
+            ok = false;
+            return string();
+        }
+        p += n;
+        return string(p - n, n);
+    };
+
+    uint32_t count = u32();
+    active = u32();
+    for (uint32_t t = 0; t < count && ok; ++t)
+    {
+        tabSnapshot s;
+        s.cwd = str();
+        s.title = str();
+        s.input = str();
+        uint32_t lines = u32();
+        // each line takes at least its length field
+        if (!ok || lines > (size_t)(end - p) / 4)
+            return false;
+        s.lines.reserve(lines);
+        for (uint32_t i = 0; i < lines && ok; ++i)
+            s.lines.push_back(str());
+        saved.push_back(std::move(s));
+    }
+    return ok && p == end;
+}
+
+static void snapshotWriterLoop()
+{
+    unique_lock<mutex> lk(snapMutex);
+    while (true)
+    {
+        snapCv.wait(lk, [] { return snapStop || snapHave; });
+        if (!snapHave)
+            break;
+        vector<tabSnapshot> saved;
+        saved.swap(snapPending);
+        uint32_t active = snapPendingActive;
+        snapHave = false;
+        lk.unlock();
+
+        TRACE_SCOPE("write snapshot");
+        if (!replaceFileAtomically(snapshotPath, encodeSnapshot(saved, active)))
+            cerr << "snapshot: cannot write " << snapshotPath << "\n";
+        lk.lock();
+    }
+}
+
+// What the file would need to be rewritten for: cheap, no scrollback is read.
+static uint64_t snapshotStampOf()
+{
+    uint64_t h = 1469598103934665603ull;
+    auto mix = [&](uint64_t v) { h = (h ^ v) * 1099511628211ull; };
+    mix(tabs.size());
+    mix((uint64_t)tabActive);
+    for (auto &T : tabs)
+    {
+        mix((uint64_t)T.id);
+        mix(T.bufGen);
+        mix(T.displayBuffer.size());
+        mix(hash<string>()(T.cwd));
+        mix(hash<string>()(T.title));
+        mix(hash<string>()(T.input.str()));
+    }
+    return h;
+}
+
+// Copy the tabs for the writer thread.
+static void snapshotTake()
+{
+    TRACE_SCOPE("snapshot");
+    vector<tabSnapshot> saved;
+    for (auto &T : tabs)
+    {
+        tabSnapshot s;
+        s.cwd = T.cwd;
+        s.title = T.title;
+        s.input = T.input.str();
+        // the newest lines, within both limits
+        size_t from = T.displayBuffer.size(), bytes = 0;
+        while (from > 0 && T.displayBuffer.size() - from < SNAP_TAIL_LINES &&
+               bytes + T.displayBuffer[from - 1].size() <= SNAP_TAIL_BYTES)
+            bytes += T.displayBuffer[--from].size();
+        s.lines.assign(T.displayBuffer.begin() + from, T.displayBuffer.end());
+        saved.push_back(std::move(s));
+    }
+    {
+        lock_guard<mutex> lk(snapMutex);
+        snapPending = std::move(saved);
+        snapPendingActive = (uint32_t)max(0, tabActive);
+        snapHave = true;
+    }
+    snapCv.notify_all();
+}
+
+// Save what changed since the last snapshot and stop the writer (atexit).
+static void snapshotShutdown()
+{
+    if (snapshotStampOf() != snapStamp)
+        snapshotTake();
+    {
+        lock_guard<mutex> lk(snapMutex);
+        snapStop = true;
+    }
+    snapCv.notify_all();
+    if (snapThread.joinable())
+        snapThread.join();
+}
+
+void startSnapshots()
+{
+    if (snapThread.joinable())
+        return;
+    snapLastCheck = chrono::steady_clock::now();
+    snapThread = thread([] {
+        traceThreadName("snapshot writer");
+        snapshotWriterLoop();
+    });
+    atexit(snapshotShutdown);
+}
+
+int snapshotTick(bool activity)
+{
+    if (!snapThread.joinable())
+        return -1;
+    snapMaybeDirty |= activity;
+    if (!snapMaybeDirty)
+        return -1;
+    auto now = chrono::steady_clock::now();
+    auto due = snapLastCheck + SNAP_INTERVAL;
+    if (now < due)
+        return (int)chrono::duration_cast<chrono::milliseconds>(due - now).count() + 1;
+    snapLastCheck = now;
+    snapMaybeDirty = false;
+    uint64_t stamp = snapshotStampOf();
+    if (stamp != snapStamp)
+    {
+        snapStamp = stamp;
+        snapshotTake();
+    }
+    return -1;
+}
+
+bool snapshotRestore()
+{
+    TRACE_SCOPE("restore snapshot");
+    auto t0 = chrono::steady_clock::now();
+    int fd = open(snapshotPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return false;
+    vector<tabSnapshot> saved;
+    uint32_t active = 0;
+    bool ok = false;
+    struct stat st{};
+    if (fstat(fd, &st) == 0 && st.st_size > 0 && (size_t)st.st_size <= SNAP_MAX_FILE)
+    {
+        void *map = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED)
+        {
+            ok = decodeSnapshot((const char *)map, (size_t)st.st_size, saved, active);
+            munmap(map, (size_t)st.st_size);
+        }
+    }
+    close(fd);
+    if (!ok)
+    {
+        cerr << "snapshot: ignoring damaged " << snapshotPath << "\n";
+        return false;
+    }
+    if (saved.empty())
+        return false;
+
+    for (auto &s : saved)
+    {
+        // a directory that has gone since is replaced by /
+        struct stat ds{};
+        addTab(stat(s.cwd.c_str(), &ds) == 0 && S_ISDIR(ds.st_mode) ? s.cwd : "/");
+        tabState &T = tabs.back();
+        T.title = s.title;
+        T.input = s.input;
+        T.currentCursorPosition = (int)s.input.size();
+        T.multLineFlag = T.input.count('"') % 2 == 1;
+        resetDisplay(T, std::move(s.lines));
+        T.scrlOffset = INT_MAX; // makeScreen clamps this to the bottom
+    }
+    tabActive = (int)min<size_t>(active, tabs.size() - 1);
+    snapStamp = snapshotStampOf();
+    counters.restoreUs = usSince(t0);
+    return true;
+}
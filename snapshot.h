@@ -0,0 +1,16 @@
+#pragma once
+#include "headers.h"
+
+//  Session snapshots (snapshot.cpp)
+
+extern string snapshotPath;
+
+void startSnapshots();
+
+// Called by the event loop every iteration; activity says whether it handled
+// anything since the last call. Returns how many ms until it wants to be
+// called again, or -1 if it is not waiting for anything.
+int snapshotTick(bool activity);
+
+// Recreate the saved tabs; false (and no tabs added) if there is nothing to restore.
+bool snapshotRestore();
@@ -0,0 +1,257 @@
+#include "draw.h"
+#include "exec.h"
+#include "helper_funcs.h"
+#include "history.h"
+#include "jobs.h"
+
+using namespace std;
+
+//  Microbenchmarks (make bench)
+//
+// Times the terminal's hot paths through the same code the terminal runs:
+// screen layout into a headless framebuffer, command execution, history and
+// completion, and the multiWatch refresh cycle. Each line reports the median
+// and 99th percentile time of one run plus the throughput over all runs.
+// Scratch files go in a temporary directory that is removed afterwards.
+//
+//   termbench [GROUP...]     groups: screen exec history complete multiwatch
+
+static vector<string> benchGroups; // from the command line, empty = all
+static string benchDir;            // scratch directory
+
+static bool wanted(const string &group)
+{
+    return benchGroups.empty() || find(benchGroups.begin(), benchGroups.end(), group) != benchGroups.end();
+}
+
+// Seconds taken by each of n calls of fn.
+template <class F>
+static vector<double> timeRuns(int n, F fn)
+{
+    vector<double> t;
+    t.reserve(n);
+    for (int i = 0; i < n; ++i)
+    {
+        auto t0 = chrono::steady_clock::now();
+        fn();
+        t.push_back(chrono::duration<double>(chrono::steady_clock::now() - t0).count());
+    }
+    return t;
+}
+
+static string fmtTime(double s)
+{
+    char buf[32];
+    if (s < 1e-6)
+        snprintf(buf, sizeof(buf), "%.0f ns", s * 1e9);
+    else if (s < 1e-3)
+        snprintf(buf, sizeof(buf), "%.1f us", s * 1e6);
+    else if (s < 1.0)
+        snprintf(buf, sizeof(buf), "%.2f ms", s * 1e3);
+    else
+        snprintf(buf, sizeof(buf), "%.2f s", s);
+    return buf;
+}
+
+// perRun units of work are done by each run; throughput is over all runs.
+static void report(const string &name, vector<double> t, double perRun, const char *unit)
+{
+    if (t.empty())
+        return;
+    sort(t.begin(), t.end());
+    double total = accumulate(t.begin(), t.end(), 0.0);
+    // nearest rank
+    auto pct = [&](double p) { return t[min(t.size() - 1, (size_t)ceil(p * t.size()) - 1)]; };
+    printf("%-44s n=%-5zu p50 %10s  p99 %10s  %12.0f %s/s\n", name.c_str(), t.size(),
+           fmtTime(pct(0.50)).c_str(), fmtTime(pct(0.99)).c_str(), total > 0 ? perRun * t.size() / total : 0.0, unit);
+    fflush(stdout);
+}
+
+static string withCount(const string &what, size_t n)
+{
+    string s = to_string(n);
+    if (n >= 1000000 && n % 1000000 == 0)
+        s = to_string(n / 1000000) + "M";
+    else if (n >= 1000 && n % 1000 == 0)
+        s = to_string(n / 1000) + "k";
+    return what + " (" + s + ")";
+}
+
+// makeScreen over 100k lines of mixed output, a tenth of them long enough to wrap.
+static void benchScreen()
+{
+    const size_t LINES = 100000;
+    winGeom.width = WIDTH;
+    winGeom.height = HEIGHT;
+    fbRenderer R(WIDTH, HEIGHT);
+    addTab("/tmp");
+    tabState &T = tabs[tabActive];
+    for (size_t i = 0; i < LINES; ++i)
+    {
+        if (i % 10 == 0)
+            T.displayBuffer.push_back(string(300, 'a' + i % 26));
+        else if (i % 10 == 5)
+            T.displayBuffer.push_back("grüße " + to_string(i) + " 日本語テキスト");
+        else
+            T.displayBuffer.push_back("line " + to_string(i) + ": -rw-r--r-- 1 user user 4096 build.log");
+    }
+    makeScreen(R, T);
+
+    report(withCount("makeScreen, wrap cached", LINES), timeRuns(2000, [&] { makeScreen(R, T); }), 1, "frames");
+    report(withCount("makeScreen, full rewrap", LINES), timeRuns(50, [&] {
+               T.wrapWidth = -1;
+               makeScreen(R, T);
+           }), LINES, "lines");
+    report("makeScreen, one line appended", timeRuns(2000, [&] {
+               T.displayBuffer.push_back("appended line");
+               makeScreen(R, T);
+           }), 1, "frames");
+    tabs.clear();
+}
+
+static void benchExec()
+{
+    addTab("/tmp");
+    tabState &T = tabs[tabActive];
+    report("execInDir true", timeRuns(200, [&] { execInDir("true", T); }), 1, "cmds");
+    report("execInDir echo hello", timeRuns(200, [&] { execInDir("echo hello", T); }), 1, "cmds");
+    report("execInDir ls -l /usr/bin", timeRuns(50, [&] { execInDir("ls -l /usr/bin", T); }), 1, "cmds");
+    const size_t LINES = 10000000;
+    report("pipeline yes | head -n 10M", timeRuns(3, [&] { execInDir("yes | head -n " + to_string(LINES), T); }),
+           LINES, "lines");
+    tabs.clear();
+}
+
+// Load, append and search at several history sizes, on a scratch history file.
+static void benchHistory()
+{
+    historyPath = benchDir + "/history.bin";
+    legacyHistoryPath = benchDir + "/no-legacy-history";
+    for (size_t n : {10000, 100000, 1000000})
+    {
+        string file = historyFileHeader();
+        for (size_t i = 0; i < n; ++i)
+        {
+            historyMeta m;
+            m.index = i + 1;
+            m.time = 1700000000 + (int64_t)i;
+            m.exitCode = 0;
+            file += encodeHistoryRecord(m, "/home/user/src", "make -j8 target" + to_string(i % 5000));
+        }
+        if (!replaceFileAtomically(historyPath, file))
+            errx(1, "cannot write %s", historyPath.c_str());
+
+        report(withCount("history load", n), timeRuns(3, loadHistory), n, "entries");
+        report(withCount("history append", n), timeRuns(1000, [] { storeHistory("echo bench", "/tmp", 0, 1); }),
+               1, "appends");
+        // no match: the whole history is scanned
+        int runs = (int)max<size_t>(20, 2000000 / n);
+        report(withCount("history search", n), timeRuns(runs, [] { searchFromHistory("zz no match"); }), n, "entries");
+    }
+    unlink(historyPath.c_str());
+    resetHistoryMemory();
+}
+
+// Tab completion in a large directory: the ls it runs, then the prefix match.
+static void benchComplete()
+{
+    for (size_t n : {10000, 100000})
+    {
+        string dir = benchDir + "/complete" + to_string(n);
+        mkdir(dir.c_str(), 0755);
+        for (size_t i = 0; i < n; ++i)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "/file_%07zu.txt", i);
+            int fd = open((dir + name).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+            if (fd >= 0)
+                close(fd);
+        }
+        addTab(dir);
+        tabState &T = tabs[tabActive];
+        vector<string> names;
+        report(withCount("completion ls", n), timeRuns(10, [&] { names = execInDir("ls", T); }), n, "entries");
+        report(withCount("getRecommendations", n), timeRuns(200, [&] { getRecommendations("file_00042", names); }),
+               n, "entries");
+        tabs.clear();
+        for (size_t i = 0; i < n; ++i)
+        {
+            char name[32];
+            snprintf(name, sizeof(name), "/file_%07zu.txt", i);
+            unlink((dir + name).c_str());
+        }
+        rmdir(dir.c_str());
+    }
+}
+
+// multiWatch refreshing back to back: what one cycle costs beyond its wait.
+static void benchMultiWatch()
+{
+    const int CYCLES = 100;
+    addTab("/tmp");
+    int id = tabs[tabActive].id;
+    auto savedRefresh = mwRefresh;
+    mwRefresh = chrono::milliseconds(0);
+    thread watcher(multiWatchThreaded_using_pipes, vector<string>{"true", "echo hello"}, id, vector<string>{},
+                   startWatch(id));
+
+    vector<double> cycles;
+    auto last = chrono::steady_clock::now();
+    bool first = true;
+    while ((int)cycles.size() < CYCLES)
+    {
+        struct pollfd p{uiWakeFd, POLLIN, 0};
+        if (poll(&p, 1, 5000) <= 0)
+            break;
+        uint64_t n;
+        if (read(uiWakeFd, &n, sizeof(n)) < 0) {}
+        if (!framePending(id))
+            continue;
+        dropPendingFrame(id);
+        auto now = chrono::steady_clock::now();
+        if (!first) // the first frame includes thread start-up
+            cycles.push_back(chrono::duration<double>(now - last).count());
+        first = false;
+        last = now;
+    }
+
+    stopWatch(id);
+    watcher.join();
+    mwRefresh = savedRefresh;
+    dropPendingFrame(id);
+    report("multiWatch cycle, 2 commands", cycles, 1, "cycles");
+    tabs.clear();
+}
+
+int main(int argc, char **argv)
+{
+    static const char *groups[] = {"screen", "exec", "history", "complete", "multiwatch"};
+    for (int i = 1; i < argc; ++i)
+    {
+        if (find(begin(groups), end(groups), string(argv[i])) == end(groups))
+            errx(1, "usage: %s [screen|exec|history|complete|multiwatch ...]", argv[0]);
+        benchGroups.push_back(argv[i]);
+    }
+
+    char dir[] = "/tmp/termbench.XXXXXX";
+    if (!mkdtemp(dir))
+        err(1, "mkdtemp");
+    benchDir = dir;
+
+    // worker threads and background jobs see the same setup as in the terminal
+    initChildWatch();
+
+    if (wanted("screen"))
+        benchScreen();
+    if (wanted("exec"))
+        benchExec();
+    if (wanted("history"))
+        benchHistory();
+    if (wanted("complete"))
+        benchComplete();
+    if (wanted("multiwatch"))
+        benchMultiWatch();
+
+    rmdir(benchDir.c_str());
+    return 0;
+}
@@ -1,5 +1,9 @@
-#include "headers.cpp"
-#include "run.cpp"
+#include "run.h"
+#include "draw.h"
+#include "exec.h"
+#include "helper_funcs.h"
+#include "history.h"
+#include "jobs.h"
 
 using namespace std;
 
@@ -10,12 +14,23 @@ int main(int argc, char** argv)
 
     Window win;
 
+    // UTF-8 keyboard input through XIM follows the locale
+    setlocale(LC_CTYPE, "");
+    XSetLocaleModifiers("");
+
     disp = XOpenDisplay(NULL);
     if (disp == NULL)
     {
         errx(1, "Cant open display");
     }
-    inputs = getHistory();
+    // child exits (pidfd / signalfd) drive reaping of background jobs; set up
+    // before the first thread starts, which the signalfd fallback depends on
+    initChildWatch();
+
+    // in the background, so the window does not wait for it; a replay brings
+    // its own history
+    if (!getenv("SHRETERM_REPLAY"))
+        loadHistoryAsync(wakeUi);
 
     scr = DefaultScreen(disp);
     root = RootWindow(disp, scr);
@@ -0,0 +1,297 @@
+#include "termstat.h"
+#include "counters.h"
+#include "history.h"
+
+//  termstat: keystroke-to-photon latency and the counters (counters.cpp)
+//
+// The event loop stamps each key or button press as it comes off the queue
+// (latencyInput). makeScreen marks that a frame was drawn (latencyDrawn),
+// and when the loop flushes its requests to the server before sleeping
+// (latencyFlushed) the time since the oldest unanswered input is one sample.
+// An input that drew nothing is not a sample. The numbers are shown by the
+// hidden `termstat` builtin and, after `termstat overlay`, in the corner of
+// the screen.
+//
+// Samples go into a log-linear histogram: four buckets per power of two of
+// microseconds, so every bucket is within 25% of its value.
+
+static const int LAT_BUCKETS = 104; // up to 2^26 us (about 67 s)
+
+struct latencyStats
+{
+    uint64_t buckets[LAT_BUCKETS] = {};
+    uint64_t count = 0;
+    uint64_t sumUs = 0;
+    uint64_t minUs = UINT64_MAX;
+    uint64_t maxUs = 0;
+    uint64_t lastUs = 0;
+};
+static latencyStats latency;
+bool latencyOverlay = false;
+
+static bool latencyWaiting = false; // an input has not been answered yet
+static bool latencyPainted = false; // and a frame was drawn since
+static chrono::steady_clock::time_point latencyInputAt;
+
+static int latencyBucket(uint64_t us)
+{
+    if (us < 4)
+        return (int)us;
+    int e = 63 - __builtin_clzll(us);
+    int idx = 4 * (e - 1) + (int)((us >> (e - 2)) - 4);
+    return min(idx, LAT_BUCKETS - 1);
+}
+
+// smallest value that lands in bucket idx
+static uint64_t latencyBucketLow(int idx)
+{
+    if (idx < 4)
+        return (uint64_t)idx;
+    int e = idx / 4 + 1;
+    return (uint64_t)(idx % 4 + 4) << (e - 2);
+}
+
+void latencyInput()
+{
+    if (latencyWaiting)
+        return; // measure from the oldest input in a burst
+    latencyWaiting = true;
+    latencyPainted = false;
+    latencyInputAt = chrono::steady_clock::now();
+}
+
+void latencyDrawn()
+{
+    latencyPainted = latencyWaiting;
+}
+
+void latencyFlushed()
+{
+    if (!latencyWaiting)
+        return;
+    latencyWaiting = false;
+    if (!latencyPainted)
+        return;
+    uint64_t us = (uint64_t)chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - latencyInputAt).count();
+    latency.buckets[latencyBucket(us)]++;
+    latency.count++;
+    latency.sumUs += us;
+    latency.minUs = min(latency.minUs, us);
+    latency.maxUs = max(latency.maxUs, us);
+    latency.lastUs = us;
+}
+
+// Upper end of the bucket holding the p-th fraction of the samples.
+static uint64_t latencyPercentile(double p)
+{
+    if (latency.count == 0)
+        return 0;
+    uint64_t rank = (uint64_t)ceil(p * latency.count);
+    uint64_t seen = 0;
+    for (int i = 0; i < LAT_BUCKETS; ++i)
+    {
+        seen += latency.buckets[i];
+        if (seen >= max<uint64_t>(rank, 1))
+            return min(latency.maxUs, latencyBucketLow(i + 1) - 1);
+    }
+    return latency.maxUs;
+}
+
+static string fmtMs(uint64_t us)
+{
+    ostringstream s;
+    s << fixed << setprecision(us < 10000 ? 2 : 1) << us / 1000.0 << " ms";
+    return s.str();
+}
+
+string latencySummary()
+{
+    if (latency.count == 0)
+        return "latency: no samples";
+    return "latency " + fmtMs(latency.lastUs) + "  p50 " + fmtMs(latencyPercentile(0.5)) + "  p99 " +
+           fmtMs(latencyPercentile(0.99)) + "  n=" + to_string(latency.count);
+}
+
+static string fmtBytes(uint64_t b)
+{
+    ostringstream s;
+    if (b < 1024)
+        s << b << " B";
+    else if (b < (1u << 20))
+        s << fixed << setprecision(1) << b / 1024.0 << " KiB";
+    else
+        s << fixed << setprecision(1) << b / 1048576.0 << " MiB";
+    return s.str();
+}
+
+static uint64_t historyFileBytes()
+{
+    struct stat st{};
+    return (histFd >= 0 && fstat(histFd, &st) == 0) ? (uint64_t)st.st_size : 0;
+}
+
+static vector<string> latencyLines()
+{
+    vector<string> out;
+    out.push_back("termstat: keystroke-to-photon latency (input dequeued -> frame flushed)");
+    if (latency.count == 0)
+    {
+        out.push_back("  no samples yet");
+        return out;
+    }
+    out.push_back("  samples " + to_string(latency.count) + ", min " + fmtMs(latency.minUs) + ", mean " +
+                  fmtMs(latency.sumUs / latency.count) + ", p50 " + fmtMs(latencyPercentile(0.5)) + ", p90 " +
+                  fmtMs(latencyPercentile(0.9)) + ", p99 " + fmtMs(latencyPercentile(0.99)) + ", max " +
+                  fmtMs(latency.maxUs));
+    uint64_t most = *max_element(begin(latency.buckets), end(latency.buckets));
+    for (int i = 0; i < LAT_BUCKETS; ++i)
+    {
+        if (!latency.buckets[i])
+            continue;
+        char range[48];
+        snprintf(range, sizeof(range), "  %8.2f - %8.2f ms ", latencyBucketLow(i) / 1000.0, latencyBucketLow(i + 1) / 1000.0);
+        size_t bar = (size_t)max<uint64_t>(1, latency.buckets[i] * 40 / most);
+        out.push_back(range + string(bar, '#') + " " + to_string(latency.buckets[i]));
+    }
+    return out;
+}
+
+static void timingLines(vector<string> &out, const map<string, timingStat> &m)
+{
+    for (auto &[name, t] : m)
+    {
+        char line[64];
+        snprintf(line, sizeof(line), "%8llu  avg %10s  max %10s  ", (unsigned long long)t.count,
+                 fmtMs(t.totalUs / t.count).c_str(), fmtMs(t.maxUs).c_str());
+        out.push_back("    " + string(line) + name);
+    }
+}
+
+static vector<string> counterLines()
+{
+    vector<string> out;
+    out.push_back("termstat: counters since start");
+    out.push_back("  forks " + to_string(counters.forks.load()) + ", " + fmtBytes(counters.captureBytes.load()) +
+                  " captured from command output");
+    out.push_back("  makeScreen " + to_string(counters.screenCalls) + " calls, " + fmtMs(counters.screenUs) +
+                  " total" + (counters.screenCalls ? ", " + fmtMs(counters.screenUs / counters.screenCalls) + " avg" : "") +
+                  "; " + to_string(counters.wrappedLines) + " lines wrapped");
+    out.push_back("  X requests " + to_string(counters.xRequests));
+    if (counters.startupUs)
+        out.push_back("  startup " + fmtMs(counters.startupUs) + " to the first frame" +
+                      (counters.restoreUs ? ", of which " + fmtMs(counters.restoreUs) + " restoring tabs" : ""));
+    out.push_back("  history " + to_string(inputs.size()) + " entries, file " + fmtBytes(historyFileBytes()) +
+                  ", loaded in " + fmtMs(counters.historyLoadUs) + " (in the background)");
+
+    lock_guard<mutex> lk(statMutex);
+    if (!execTimes.empty())
+    {
+        out.push_back("  exec latency by program:");
+        timingLines(out, execTimes);
+    }
+    if (watchCycles.count)
+    {
+        out.push_back("  multiWatch " + to_string(watchCycles.count) + " cycles, avg " +
+                      fmtMs(watchCycles.totalUs / watchCycles.count) + ", max " + fmtMs(watchCycles.maxUs) + "; by command:");
+        timingLines(out, watchTimes);
+    }
+    return out;
+}
+
+static string jsonString(const string &s)
+{
+    string out = "\"";
+    for (unsigned char c : s)
+    {
+        if (c == '"' || c == '\\')
+            out += '\\', out += (char)c;
+        else if (c < 0x20)
+        {
+            char esc[8];
+            snprintf(esc, sizeof(esc), "\\u%04x", c);
+            out += esc;
+        }
+        else
+            out += (char)c;
+    }
+    return out + "\"";
+}
+
+static string jsonTiming(const timingStat &t)
+{
+    return "{\"count\":" + to_string(t.count) + ",\"total_us\":" + to_string(t.totalUs) + ",\"max_us\":" +
+           to_string(t.maxUs) + "}";
+}
+
+static string jsonTimings(const map<string, timingStat> &m)
+{
+    string out = "{";
+    for (auto &[name, t] : m)
+        out += (out.size() > 1 ? "," : "") + jsonString(name) + ":" + jsonTiming(t);
+    return out + "}";
+}
+
+// Everything as one JSON object on one line, times in microseconds.
+static string termstatJson()
+{
+    string j = "{\"latency\":{\"samples\":" + to_string(latency.count) + ",\"min_us\":" +
+               to_string(latency.count ? latency.minUs : 0) + ",\"p50_us\":" + to_string(latencyPercentile(0.5)) +
+               ",\"p90_us\":" + to_string(latencyPercentile(0.9)) + ",\"p99_us\":" +
+               to_string(latencyPercentile(0.99)) + ",\"max_us\":" + to_string(latency.maxUs) + "}";
+    j += ",\"forks\":" + to_string(counters.forks.load());
+    j += ",\"capture_bytes\":" + to_string(counters.captureBytes.load());
+    j += ",\"make_screen\":{\"calls\":" + to_string(counters.screenCalls) + ",\"total_us\":" +
+         to_string(counters.screenUs) + "}";
+    j += ",\"wrapped_lines\":" + to_string(counters.wrappedLines);
+    j += ",\"x_requests\":" + to_string(counters.xRequests);
+    j += ",\"startup_us\":" + to_string(counters.startupUs);
+    j += ",\"restore_us\":" + to_string(counters.restoreUs);
+    j += ",\"history\":{\"entries\":" + to_string(inputs.size()) + ",\"file_bytes\":" +
+         to_string(historyFileBytes()) + ",\"load_us\":" + to_string(counters.historyLoadUs) + "}";
+    lock_guard<mutex> lk(statMutex);
+    j += ",\"exec\":" + jsonTimings(execTimes);
+    j += ",\"multiwatch\":{\"cycles\":" + jsonTiming(watchCycles) + ",\"commands\":" + jsonTimings(watchTimes) + "}";
+    return j + "}";
+}
+
+vector<string> termstatBuiltin(const string &arg, const string &cwd)
+{
+    if (arg == "reset")
+    {
+        latency = latencyStats();
+        counters.forks = 0;
+        counters.captureBytes = 0;
+        counters.screenCalls = counters.screenUs = counters.wrappedLines = 0;
+        lock_guard<mutex> lk(statMutex);
+        execTimes.clear();
+        watchTimes.clear();
+        watchCycles = timingStat();
+        return {"termstat: cleared"};
+    }
+    if (arg == "overlay")
+    {
+        latencyOverlay = !latencyOverlay;
+        return {string("termstat: overlay ") + (latencyOverlay ? "on" : "off")};
+    }
+    if (arg == "--json")
+        return {termstatJson()};
+    if (arg.rfind("--json ", 0) == 0)
+    {
+        string path = arg.substr(7);
+        path.erase(0, path.find_first_not_of(" \t"));
+        if (path[0] != '/')
+            path = cwd + "/" + path;
+        ofstream f(path, ios::trunc);
+        f << termstatJson() << "\n";
+        if (!f.flush())
+            return {"ERROR: termstat: cannot write " + path};
+        return {"termstat: wrote " + path};
+    }
+    if (!arg.empty())
+        return {"Usage: termstat [reset|overlay|--json [file]]"};
+
+    vector<string> out = latencyLines();
+    for (auto &line : counterLines())
+        out.push_back(std::move(line));
+    return out;
+}
@@ -0,0 +1,15 @@
+#pragma once
+#include "headers.h"
+
+//  termstat: keystroke-to-photon latency and the counters (termstat.cpp)
+
+extern bool latencyOverlay; // latencySummary() in the corner of the screen
+
+// an input came off the queue / a frame was drawn / requests were flushed
+void latencyInput();
+void latencyDrawn();
+void latencyFlushed();
+// One line for the overlay.
+string latencySummary();
+// termstat [reset|overlay|--json [FILE]]; a relative FILE is under cwd.
+vector<string> termstatBuiltin(const string &arg, const string &cwd);
@@ -0,0 +1,241 @@
+#include "text.h"
+
+//  Text: UTF-8, character widths and glyph drawing
+//
+// Buffers keep UTF-8 bytes. Layout decodes them into codepoints and gives
+// every character 0, 1 or 2 cells (combining marks take none, East Asian
+// wide and fullwidth forms take two), so wrapping and cursor positions are
+// cell arithmetic on a monospace grid. Glyphs are resolved once per
+// (codepoint, attributes), falling back to another font for characters the
+// main one lacks, and every run of same-coloured text is sent to the server
+// as a single XftDrawGlyphFontSpec request.
+
+uint32_t decodeUtf8(const char *s, size_t n, size_t &used)
+{
+    unsigned char c = (unsigned char)s[0];
+    used = 1;
+    if (c < 0x80)
+        return c;
+    int extra = (c >= 0xF0 && c < 0xF5) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC2 && c < 0xE0) ? 1 : -1;
+    if (c >= 0xF5 || extra < 0 || (size_t)extra >= n)
+        return 0xFFFD;
+    uint32_t cp = c & (0x3F >> extra);
+    for (int k = 1; k <= extra; ++k)
+    {
+        unsigned char cc = (unsigned char)s[k];
+        if ((cc & 0xC0) != 0x80)
+            return 0xFFFD;
+        cp = (cp << 6) | (cc & 0x3F);
+    }
+    // overlong forms, surrogates and values past U+10FFFF
+    if ((extra == 2 && cp < 0x800) || (extra == 3 && (cp < 0x10000 || cp > 0x10FFFF)) ||
+        (cp >= 0xD800 && cp <= 0xDFFF))
+        return 0xFFFD;
+    used = extra + 1;
+    return cp;
+}
+
+void appendUtf8(string &out, uint32_t cp)
+{
+    if (cp < 0x80)
+        out += (char)cp;
+    else if (cp < 0x800)
+    {
+        out += (char)(0xC0 | (cp >> 6));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+        out += (char)(0xE0 | (cp >> 12));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+        out += (char)(0xF0 | (cp >> 18));
+        out += (char)(0x80 | ((cp >> 12) & 0x3F));
+        out += (char)(0x80 | ((cp >> 6) & 0x3F));
+        out += (char)(0x80 | (cp & 0x3F));
+    }
+}
+
+// [first, last] codepoint ranges, sorted
+struct cpRange
+{
+    uint32_t first, last;
+};
+
+static const cpRange zeroWidthRanges[] = {
+    {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x0610, 0x061A}, {0x064B, 0x065F},
+    {0x0E31, 0x0E31}, {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1AB0, 0x1AFF}, {0x1DC0, 0x1DFF},
+    {0x200B, 0x200F}, {0x202A, 0x202E}, {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0xFE00, 0xFE0F},
+    {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xE0100, 0xE01EF},
+};
+
+static const cpRange wideRanges[] = {
+    {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x25FD, 0x25FE},
+    {0x2614, 0x2615}, {0x2648, 0x2653}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26F5, 0x26F5},
+    {0x26FA, 0x26FA}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x274C, 0x274C}, {0x2753, 0x2755},
+    {0x2757, 0x2757}, {0x2795, 0x2797}, {0x2B1B, 0x2B1C}, {0x2E80, 0x303E}, {0x3041, 0x33FF},
+    {0x3400, 0x4DBF}, {0x4E00, 0x9FFF}, {0xA000, 0xA4CF}, {0xA960, 0xA97F}, {0xAC00, 0xD7A3},
+    {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6},
+    {0x16FE0, 0x16FE4}, {0x17000, 0x18AFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004},
+    {0x1F0CF, 0x1F0CF}, {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F251},
+    {0x1F300, 0x1F64F}, {0x1F680, 0x1F6FF}, {0x1F7E0, 0x1F7EB}, {0x1F90C, 0x1F9FF},
+    {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD},
+};
+
+template <size_t N>
+static bool inRanges(const cpRange (&r)[N], uint32_t cp)
+{
+    auto it = upper_bound(begin(r), end(r), cp, [](uint32_t c, const cpRange &x) { return c < x.first; });
+    return it != begin(r) && cp <= (it - 1)->last;
+}
+
+int charCells(uint32_t cp)
+{
+    if (cp < 0x300)
+        return 1;
+    static vector<unsigned char> bmp;
+    if (bmp.empty())
+    {
+        bmp.resize(0x10000);
+        for (uint32_t c = 0; c < 0x10000; ++c)
+            bmp[c] = inRanges(zeroWidthRanges, c) ? 0 : inRanges(wideRanges, c) ? 2 : 1;
+    }
+    if (cp < 0x10000)
+        return bmp[cp];
+    return inRanges(zeroWidthRanges, cp) ? 0 : inRanges(wideRanges, cp) ? 2 : 1;
+}
+
+size_t textCells(const char *s, size_t n)
+{
+    size_t cells = 0;
+    for (size_t i = 0; i < n;)
+    {
+        if ((unsigned char)s[i] < 0x80)
+        {
+            ++cells;
+            ++i;
+            continue;
+        }
+        size_t used;
+        cells += charCells(decodeUtf8(s + i, n - i, used));
+        i += used;
+    }
+    return cells;
+}
+
+//  Font and glyph cache
+
+textFont *openTextFont(Display *dpy, int screen, Drawable d)
+{
+    const char *name = getenv("SHRETERM_FONT");
+    XftFont *xft = (name && *name) ? XftFontOpenName(dpy, screen, name) : nullptr;
+    if (!xft)
+        xft = XftFontOpenName(dpy, screen, "monospace:pixelsize=15");
+    if (!xft)
+        return nullptr;
+
+    textFont *f = new textFont;
+    f->dpy = dpy;
+    f->screen = screen;
+    f->xft = xft;
+    f->ascent = xft->ascent;
+    f->descent = xft->descent;
+    XGlyphInfo ext;
+    XftTextExtentsUtf8(dpy, xft, (const FcChar8 *)"M", 1, &ext);
+    f->cellW = max<int>(1, ext.xOff);
+    f->draw = XftDrawCreate(dpy, d, DefaultVisual(dpy, screen), DefaultColormap(dpy, screen));
+    return f;
+}
+
+const XftColor *textColor(textFont *f, unsigned long rgb)
+{
+    auto it = f->colors.find(rgb);
+    if (it != f->colors.end())
+        return &it->second;
+    XRenderColor rc;
+    rc.red = (unsigned short)(((rgb >> 16) & 0xFF) * 0x101);
+    rc.green = (unsigned short)(((rgb >> 8) & 0xFF) * 0x101);
+    rc.blue = (unsigned short)((rgb & 0xFF) * 0x101);
+    rc.alpha = 0xFFFF;
+    XftColor c;
+    if (!XftColorAllocValue(f->dpy, DefaultVisual(f->dpy, f->screen), DefaultColormap(f->dpy, f->screen), &rc, &c))
+        c.pixel = WhitePixel(f->dpy, f->screen);
+    return &f->colors.emplace(rgb, c).first->second;
+}
+
+glyphRef lookupGlyph(textFont *f, uint32_t cp, unsigned attr)
+{
+    uint64_t key = ((uint64_t)cp << 8) | attr;
+    auto it = f->glyphs.find(key);
+    if (it != f->glyphs.end())
+        return it->second;
+
+    glyphRef g{f->xft, 0};
+    if (XftCharExists(f->dpy, f->xft, cp))
+        g.index = XftCharIndex(f->dpy, f->xft, cp);
+    else
+    {
+        bool found = false;
+        for (XftFont *fb : f->fallbacks)
+            if (XftCharExists(f->dpy, fb, cp))
+            {
+                g = {fb, XftCharIndex(f->dpy, fb, cp)};
+                found = true;
+                break;
+            }
+        if (!found)
+        {
+            // ask fontconfig for a font like the main one that has cp
+            FcPattern *pat = FcPatternDuplicate(f->xft->pattern);
+            FcPatternDel(pat, FC_CHARSET);
+            FcCharSet *cs = FcCharSetCreate();
+            FcCharSetAddChar(cs, cp);
+            FcPatternAddCharSet(pat, FC_CHARSET, cs);
+            FcResult res;
+            FcPattern *match = FcFontMatch(nullptr, pat, &res);
+            XftFont *fb = match ? XftFontOpenPattern(f->dpy, match) : nullptr;
+            if (fb && XftCharExists(f->dpy, fb, cp))
+            {
+                f->fallbacks.push_back(fb);
+                g = {fb, XftCharIndex(f->dpy, fb, cp)};
+                found = true;
+            }
+            else if (fb)
+                XftFontClose(f->dpy, fb);
+            else if (match)
+                FcPatternDestroy(match);
+            FcCharSetDestroy(cs);
+            FcPatternDestroy(pat);
+        }
+        if (!found)
+            g.index = XftCharIndex(f->dpy, f->xft, 0xFFFD); // 0 (.notdef) if absent too
+    }
+    f->glyphs.emplace(key, g);
+    return g;
+}
+
+int xftDrawRun(textFont *f, int x, int y, const char *s, size_t n, unsigned long rgb)
+{
+    f->specs.clear();
+    int cx = x;
+    for (size_t i = 0; i < n;)
+    {
+        size_t used;
+        uint32_t cp = decodeUtf8(s + i, n - i, used);
+        i += used;
+        int cells = charCells(cp);
+        if (cp >= 0x20 && cp != 0x7F)
+        {
+            glyphRef g = lookupGlyph(f, cp, TEXT_REGULAR);
+            // combining marks (0 cells) are positioned over the previous character
+            f->specs.push_back({g.font, g.index, (short)(cells == 0 ? cx - f->cellW : cx), (short)y});
+        }
+        cx += cells * f->cellW;
+    }
+    if (!f->specs.empty())
+        XftDrawGlyphFontSpec(f->draw, textColor(f, rgb), f->specs.data(), (int)f->specs.size());
+    return cx - x;
+}
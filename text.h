@@ -0,0 +1,73 @@
+#pragma once
+#include "headers.h"
+
+//  Text: UTF-8, character widths and glyph drawing (text.cpp)
+
+// Decode the character at s[0..n). Invalid or truncated sequences decode
+// as U+FFFD and consume one byte.
+uint32_t decodeUtf8(const char *s, size_t n, size_t &used);
+void appendUtf8(string &out, uint32_t cp);
+
+// Byte offset of the character boundary before / after pos.
+template <typename Text>
+size_t utf8Prev(const Text &t, size_t pos)
+{
+    while (pos > 0 && (((unsigned char)t[--pos]) & 0xC0) == 0x80)
+        ;
+    return pos;
+}
+
+template <typename Text>
+size_t utf8Next(const Text &t, size_t pos)
+{
+    size_t n = t.size();
+    if (pos < n)
+        ++pos;
+    while (pos < n && (((unsigned char)t[pos]) & 0xC0) == 0x80)
+        ++pos;
+    return pos;
+}
+
+// Cells a character occupies. The Basic Multilingual Plane is answered
+// from a table built on first use; the rest searches the range lists.
+int charCells(uint32_t cp);
+// Cells taken by n bytes of UTF-8.
+size_t textCells(const char *s, size_t n);
+
+//  Font and glyph cache
+
+const unsigned TEXT_REGULAR = 0; // glyph attributes (only regular so far)
+
+struct glyphRef
+{
+    XftFont *font;
+    FT_UInt index;
+};
+
+struct glyphAtlas; // atlas.cpp
+
+struct textFont
+{
+    Display *dpy = nullptr;
+    int screen = 0;
+    XftFont *xft = nullptr;       // main font
+    vector<XftFont *> fallbacks;  // opened for characters the main font lacks
+    int ascent = 0;
+    int descent = 0;
+    int cellW = 1;                // advance of one cell
+    XftDraw *draw = nullptr;      // bound to the terminal window
+    unordered_map<uint64_t, glyphRef> glyphs; // (codepoint << 8 | attributes)
+    unordered_map<unsigned long, XftColor> colors; // by 0xRRGGBB
+    vector<XftGlyphFontSpec> specs; // scratch for one run
+    glyphAtlas *atlas = nullptr;  // XRender atlas renderer state, if set up
+    bool useAtlas = false;        // draw through the atlas instead of Xft
+};
+
+// Open the terminal font (SHRETERM_FONT, a fontconfig name, overrides the
+// default) and bind it to the window d. Returns nullptr if nothing opens.
+textFont *openTextFont(Display *dpy, int screen, Drawable d);
+// Colour for 0xRRGGBB; .pixel can be used with a GC as well.
+const XftColor *textColor(textFont *f, unsigned long rgb);
+glyphRef lookupGlyph(textFont *f, uint32_t cp, unsigned attr);
+// Draw n bytes of UTF-8 with the baseline at y; returns the advance.
+int xftDrawRun(textFont *f, int x, int y, const char *s, size_t n, unsigned long rgb);
@@ -0,0 +1,198 @@
+#include "trace.h"
+
+//  Event tracing (Chrome trace format)
+//
+// TRACE_SCOPE("name") records how long the enclosing scope took. Each
+// thread appends to its own ring buffer, so recording takes no lock: the
+// event is written and then published by a release store of the buffer's
+// head. `trace dump` copies every buffer and drops whatever a writer may
+// have overwritten meanwhile, then writes a JSON file that chrome://tracing
+// and Perfetto open directly. When tracing is off a scope costs one relaxed
+// load. SHRETERM_TRACE=1 turns it on from startup, the `trace` builtin
+// at run time.
+//
+// Threads come and go (multiWatch starts new workers every refresh), so a
+// buffer is handed to the next new thread once its owner exits. Buffers are
+// never freed.
+
+struct traceEvent
+{
+    const char *name;     // string literal
+    uint64_t startNs;     // since traceEpoch
+    uint64_t durNs;
+    char detail[48];      // e.g. the command, truncated
+};
+
+static const size_t TRACE_EVENTS = 1 << 14; // per thread; the oldest are overwritten
+
+struct traceBuffer
+{
+    int tid = 0;
+    atomic<bool> owned{true};
+    atomic<uint64_t> head{0}; // events ever written
+    atomic<const char *> threadName{nullptr};
+    traceEvent events[TRACE_EVENTS];
+};
+
+atomic<bool> traceOn(getenv("SHRETERM_TRACE") != nullptr);
+static const auto traceEpoch = chrono::steady_clock::now();
+static mutex traceRegistryMutex;
+static vector<traceBuffer *> traceBuffers; // guarded by traceRegistryMutex
+
+// Gives the thread's buffer back when the thread exits.
+struct traceOwner
+{
+    traceBuffer *buf = nullptr;
+    ~traceOwner()
+    {
+        if (buf)
+            buf->owned.store(false, memory_order_release);
+    }
+};
+static thread_local traceOwner traceSelf;
+
+uint64_t traceNow()
+{
+    return (uint64_t)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - traceEpoch).count();
+}
+
+static traceBuffer *traceThreadBuffer()
+{
+    if (traceSelf.buf)
+        return traceSelf.buf;
+    lock_guard<mutex> lk(traceRegistryMutex);
+    for (traceBuffer *b : traceBuffers)
+    {
+        bool expected = false;
+        if (b->owned.compare_exchange_strong(expected, true, memory_order_acquire))
+        {
+            b->threadName.store(nullptr);
+            return traceSelf.buf = b;
+        }
+    }
+    traceBuffer *b = new traceBuffer;
+    b->tid = (int)traceBuffers.size() + 1;
+    traceBuffers.push_back(b);
+    return traceSelf.buf = b;
+}
+
+void traceRecord(const char *name, uint64_t startNs, const char *detail)
+{
+    uint64_t end = traceNow();
+    traceBuffer *b = traceThreadBuffer();
+    uint64_t h = b->head.load(memory_order_relaxed);
+    traceEvent &e = b->events[h % TRACE_EVENTS];
+    e.name = name;
+    e.startNs = startNs;
+    e.durNs = end - startNs;
+    snprintf(e.detail, sizeof(e.detail), "%s", detail ? detail : "");
+    b->head.store(h + 1, memory_order_release);
+}
+
+void traceThreadName(const char *name)
+{
+    if (traceOn.load(memory_order_relaxed))
+        traceThreadBuffer()->threadName.store(name);
+}
+
+static void traceJsonString(ostream &out, const char *s)
+{
+    out << '"';
+    for (; *s; ++s)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            out << '\\' << (char)c;
+        else if (c < 0x20)
+            out << ' ';
+        else
+            out << (char)c;
+    }
+    out << '"';
+}
+
+// Write everything buffered as Chrome trace JSON; returns the event count or -1.
+static long traceDump(const string &path)
+{
+    ofstream out(path, ios::trunc);
+    if (!out)
+        return -1;
+    int pid = (int)getpid();
+    long written = 0;
+    vector<traceEvent> copy;
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":0,\"args\":{\"name\":\"shreTerm\"}}";
+
+    lock_guard<mutex> lk(traceRegistryMutex);
+    for (traceBuffer *b : traceBuffers)
+    {
+        uint64_t before = b->head.load(memory_order_acquire);
+        uint64_t first = before > TRACE_EVENTS ? before - TRACE_EVENTS : 0;
+        copy.clear();
+        for (uint64_t i = first; i < before; ++i)
+            copy.push_back(b->events[i % TRACE_EVENTS]);
+        // slots the writer reached while we copied may be torn: skip them
+        uint64_t after = b->head.load(memory_order_acquire);
+        uint64_t valid = after >= TRACE_EVENTS ? after - TRACE_EVENTS + 1 : 0;
+        size_t skip = (size_t)(valid > first ? min<uint64_t>(valid - first, copy.size()) : 0);
+
+        if (const char *name = b->threadName.load())
+        {
+            out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << pid << ",\"tid\":" << b->tid
+                << ",\"args\":{\"name\":";
+            traceJsonString(out, name);
+            out << "}}";
+        }
+        for (size_t i = skip; i < copy.size(); ++i)
+        {
+            const traceEvent &e = copy[i];
+            out << ",\n{\"name\":";
+            traceJsonString(out, e.name);
+            out << ",\"cat\":\"shreterm\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << b->tid << fixed
+                << setprecision(3) << ",\"ts\":" << e.startNs / 1000.0 << ",\"dur\":" << e.durNs / 1000.0;
+            if (e.detail[0])
+            {
+                out << ",\"args\":{\"detail\":";
+                traceJsonString(out, e.detail);
+                out << "}";
+            }
+            out << "}";
+            ++written;
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+    return out ? written : -1;
+}
+
+vector<string> traceBuiltin(const string &arg, const string &cwd)
+{
+    if (arg == "on" || arg == "off")
+    {
+        traceOn.store(arg == "on");
+        return {"trace: " + arg};
+    }
+    if (arg == "dump" || arg.rfind("dump ", 0) == 0)
+    {
+        string path = arg.size() > 5 ? arg.substr(5) : "";
+        path.erase(0, path.find_first_not_of(" \t"));
+        if (path.empty())
+            path = "/tmp/shreterm-trace-" + to_string(getpid()) + ".json";
+        else if (path[0] != '/')
+            path = cwd + "/" + path;
+        long n = traceDump(path);
+        if (n < 0)
+            return {"ERROR: trace: cannot write " + path};
+        return {"trace: wrote " + to_string(n) + " events to " + path};
+    }
+    if (!arg.empty())
+        return {"Usage: trace [on|off|dump [file]]"};
+
+    size_t threads;
+    {
+        lock_guard<mutex> lk(traceRegistryMutex);
+        threads = traceBuffers.size();
+    }
+    return {string("trace: ") + (traceOn.load() ? "on" : "off") + ", " + to_string(threads) +
+            " thread buffers of " + to_string(TRACE_EVENTS) + " events"};
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "headers.h"
+
+//  Event tracing (trace.cpp)
+
+extern atomic<bool> traceOn;
+
+uint64_t traceNow();
+void traceRecord(const char *name, uint64_t startNs, const char *detail);
+// Label the calling thread in the trace (a string literal).
+void traceThreadName(const char *name);
+
+struct traceScope
+{
+    const char *name;
+    const char *detail;
+    uint64_t start = 0;
+    bool on;
+
+    explicit traceScope(const char *n, const char *d = nullptr)
+        : name(n), detail(d), on(traceOn.load(memory_order_relaxed))
+    {
+        if (on)
+            start = traceNow();
+    }
+    // record now rather than at the end of the scope
+    void end()
+    {
+        if (on)
+            traceRecord(name, start, detail);
+        on = false;
+    }
+    ~traceScope() { end(); }
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(...) traceScope TRACE_CONCAT(traceScope_, __LINE__)(__VA_ARGS__)
+
+// trace [on|off|dump [FILE]]; a relative FILE is under cwd.
+vector<string> traceBuiltin(const string &arg, const string &cwd);